@@ -23,13 +23,32 @@ struct basic_data
 #define OTA_MANUFACTURER        0x1234
 #define OTA_IMAGE_TYPE          0x0021
 #define OTA_FILE_VERSION        0x00000101
+#define OTA_MAX_DATA_SIZE       64
+#define OTA_CHECKPOINT          65536
+
+#define REJOIN_ATTEMPTS         5
+#define REJOIN_DELAY            1000
+#define LINK_FAILURES           3
+#define LINK_CHECK_INTERVAL     30000
 
 #define DEFAULT_ENDPOINT        0x01
+#define CUSTOM_CLUSTER          0xFC00
+#define SCD40_MODE_ATTRIBUTE    0x0000
+#define HISTORY_REQUEST         0x00
+#define HISTORY_RESPONSE        0x01
+#define OFFLINE_SUMMARY         0x02
+#define HISTORY_CHUNK           16
+#define JOURNAL_BATCH           10
+
+#define DIAGNOSTICS_CLUSTER     0xFC01
+#define DIAGNOSTICS_LOG_REQUEST 0x00
 #define BUTTON_PIN              9
 
 #define LED_PIN                 10
 #define LED_COUNT               6
 #define LED_DEFAULT_LEVEL       50
+#define LED_FADE_TIME           1000
+#define LED_FRAME_INTERVAL      20
 
 #define PWM_TIMER               LEDC_TIMER_0
 #define PWM_CHANNEL             LEDC_CHANNEL_0
@@ -41,18 +60,54 @@ struct basic_data
 #define I2C_PORT                I2C_NUM_0
 #define I2C_SDA_PIN             2
 #define I2C_SCL_PIN             3
+#define I2C_FREQUENCY           400000
+
+#define CRC_NIBBLE_TABLE        0
+#define SCD40_INTERVAL          5000
+#define SCD40_POLL_INTERVAL     50
+#define SCD40_SHOT_INTERVAL     300000
 
 #define UART_PORT               UART_NUM_1
 #define UART_TX_PIN             4
 #define UART_RX_PIN             5
 
+#define PM1006_PASSIVE_MODE     0
+#define PM1006_INTERVAL         5000
+#define PM1006_RESPONSE_TIME    100
+
 #define RESET_COUNT             3
 #define RESET_TIMEOUT           3000
 
+#define SETTINGS_DEBOUNCE       5000
+
+#define SCHEDULER_QUEUE_LENGTH  16
+#define SCHEDULER_SLOW_JOB      50
+
+#define TIME_RETRY_INTERVAL     5000
+#define TIME_MIN_INTERVAL       900000
+#define TIME_MAX_INTERVAL       86400000
+#define TIME_MAX_ERROR          2
+
+#define OFFLINE_WINDOW          300000
+#define OFFLINE_BUCKETS         24
+#define OFFLINE_FLUSH_INTERVAL  2000
+#define OFFLINE_FLUSH_JITTER    10000
+
+#define DIAGNOSTICS_INTERVAL    60000
+#define HEAP_WARNING_LEVEL      16384
+#define STACK_WARNING_LEVEL     512
+
 #define CO2_MIN_VALUE           400
 #define CO2_MAX_VALUE           1500
 
 #define PM25_MIN_VALUE          0
 #define PM25_MAX_VALUE          100
 
+#define REPORT_MIN_INTERVAL     10
+#define REPORT_MAX_INTERVAL     600
+#define CO2_REPORT_CHANGE       25
+#define PM25_REPORT_CHANGE      2
+#define TEMP_REPORT_CHANGE      20
+#define HUMIDITY_REPORT_CHANGE  100
+
 #endif
@@ -0,0 +1,9 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint8_t crc8(const void *data, size_t length);
+
+#endif
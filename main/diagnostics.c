@@ -0,0 +1,136 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "config.h"
+#include "diagnostics.h"
+#include "led.h"
+#include "scheduler.h"
+#include "zigbee.h"
+
+#define MAX_TASKS               16
+
+struct task_runtime
+{
+    UBaseType_t number;
+    uint32_t    counter;
+};
+
+static const char *tag = "diagnostics";
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static struct scheduler_job sample_job, log_job;
+static struct diagnostics data;
+static struct task_runtime previous[MAX_TASKS];
+static TaskStatus_t tasks[MAX_TASKS];
+static uint32_t previous_total = 0;
+static uint8_t previous_count = 0;
+
+static uint32_t get_delta(const TaskStatus_t *task)
+{
+    for (uint8_t i = 0; i < previous_count; i++)
+        if (previous[i].number == task->xTaskNumber)
+            return task->ulRunTimeCounter - previous[i].counter;
+
+    return task->ulRunTimeCounter;
+}
+
+static uint8_t get_tasks(uint32_t *total)
+{
+    uint8_t count = uxTaskGetSystemState(tasks, MAX_TASKS, total);
+
+    if (!count)
+        ESP_LOGW(tag, "More than %d tasks running", MAX_TASKS);
+
+    return count;
+}
+
+static void save_counters(uint8_t count, uint32_t total)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        previous[i].number = tasks[i].xTaskNumber;
+        previous[i].counter = tasks[i].ulRunTimeCounter;
+    }
+
+    previous_count = count;
+    previous_total = total;
+}
+
+static void sample_callback(void)
+{
+    struct diagnostics sample;
+    uint32_t total, idle = 0;
+    uint8_t count = get_tasks(&total);
+
+    memset(&sample, 0, sizeof(sample));
+
+    sample.free_heap = esp_get_free_heap_size();
+    sample.minimum_heap = esp_get_minimum_free_heap_size();
+    sample.uptime = esp_timer_get_time() / 1000000;
+    sample.led_rendered = led_frames_rendered();
+    sample.led_skipped = led_frames_skipped();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (!strcmp(tasks[i].pcTaskName, "scheduler"))
+            sample.scheduler_stack = tasks[i].usStackHighWaterMark;
+        else if (!strcmp(tasks[i].pcTaskName, "zigbee"))
+            sample.zigbee_stack = tasks[i].usStackHighWaterMark;
+        else if (!strncmp(tasks[i].pcTaskName, "IDLE", 4))
+            idle += get_delta(&tasks[i]);
+
+        if (tasks[i].usStackHighWaterMark < STACK_WARNING_LEVEL)
+            ESP_LOGW(tag, "Task %s has only %ld bytes of stack left", tasks[i].pcTaskName, (uint32_t) tasks[i].usStackHighWaterMark);
+    }
+
+    if (count && total != previous_total)
+        sample.cpu_load = 100 - (uint64_t) idle * 100 / (total - previous_total);
+
+    if (sample.free_heap < HEAP_WARNING_LEVEL)
+        ESP_LOGW(tag, "Free heap is %ld bytes (minimum %ld)", sample.free_heap, sample.minimum_heap);
+
+    save_counters(count, total);
+
+    taskENTER_CRITICAL(&lock);
+    data = sample;
+    taskEXIT_CRITICAL(&lock);
+
+    zigbee_update_diagnostics();
+    scheduler_repeat(&sample_job, DIAGNOSTICS_INTERVAL);
+}
+
+static void log_callback(void)
+{
+    uint32_t total, uptime = esp_timer_get_time() / 1000000, wakeups = scheduler_wakeups();
+    uint8_t count = get_tasks(&total);
+
+    ESP_LOGI(tag, "Free heap is %ld bytes (minimum %ld), uptime is %ld s", esp_get_free_heap_size(), esp_get_minimum_free_heap_size(), uptime);
+    ESP_LOGI(tag, "Scheduler woke up %ld times, %ld per minute", wakeups, uptime ? wakeups * 60 / uptime : 0);
+    ESP_LOGI(tag, "LED rendered %ld frames, skipped %ld unchanged frames", led_frames_rendered(), led_frames_skipped());
+    zigbee_log_updates();
+
+    for (uint8_t i = 0; i < count; i++)
+        ESP_LOGI(tag, "%-16s priority %2d, stack left %5ld bytes, CPU %3ld %%", tasks[i].pcTaskName, (int) tasks[i].uxCurrentPriority, (uint32_t) tasks[i].usStackHighWaterMark, total != previous_total ? (uint32_t) ((uint64_t) get_delta(&tasks[i]) * 100 / (total - previous_total)) : 0);
+}
+
+void diagnostics_init(void)
+{
+    scheduler_init_job(&sample_job, sample_callback, "diagnostics");
+    scheduler_init_job(&log_job, log_callback, "diagnostics log");
+    scheduler_post(&sample_job);
+    scheduler_delay(&log_job, DIAGNOSTICS_INTERVAL);
+}
+
+void diagnostics_read(struct diagnostics *value)
+{
+    taskENTER_CRITICAL(&lock);
+    *value = data;
+    taskEXIT_CRITICAL(&lock);
+}
+
+void diagnostics_request_log(void)
+{
+    scheduler_post(&log_job);
+}
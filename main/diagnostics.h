@@ -0,0 +1,31 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdint.h>
+
+#define DIAGNOSTICS_FREE_HEAP           0x0000
+#define DIAGNOSTICS_MINIMUM_HEAP        0x0001
+#define DIAGNOSTICS_UPTIME              0x0002
+#define DIAGNOSTICS_SCHEDULER_STACK     0x0003
+#define DIAGNOSTICS_ZIGBEE_STACK        0x0004
+#define DIAGNOSTICS_CPU_LOAD            0x0005
+#define DIAGNOSTICS_LED_RENDERED        0x0006
+#define DIAGNOSTICS_LED_SKIPPED         0x0007
+
+struct diagnostics
+{
+    uint32_t free_heap;
+    uint32_t minimum_heap;
+    uint32_t uptime;
+    uint16_t scheduler_stack;
+    uint16_t zigbee_stack;
+    uint8_t  cpu_load;
+    uint32_t led_rendered;
+    uint32_t led_skipped;
+};
+
+void     diagnostics_init(void);
+void     diagnostics_read(struct diagnostics *value);
+void     diagnostics_request_log(void);
+
+#endif
@@ -2,7 +2,7 @@
 #include "driver/ledc.h"
 #include "esp_log.h"
 #include "config.h"
-#include "nvs_flash.h"
+#include "settings.h"
 
 static const char *tag = "fan";
 static uint8_t mode;
@@ -24,17 +24,10 @@ static void update_pwm(void)
 
 void fan_init(void)
 {
-    nvs_handle_t handle;
     ledc_timer_config_t timer_config;
     ledc_channel_config_t channel_config;
 
-    nvs_flash_init_partition("nvs");
-    nvs_open_from_partition("nvs", "nvs", NVS_READONLY, &handle);
-
-    if (nvs_get_u8(handle, "fan_mode", &mode) != ESP_OK)
-        mode = 3;
-
-    nvs_close(handle);
+    mode = settings_get(SETTING_FAN_MODE);
 
     memset(&timer_config, 0, sizeof(timer_config));
     memset(&channel_config, 0, sizeof(channel_config));
@@ -57,19 +50,11 @@ void fan_init(void)
 
 void fan_set_mode(uint8_t value)
 {
-    nvs_handle_t handle;
-
     if (mode == value)
         return;
 
     mode = value;
-
-    nvs_flash_init_partition("nvs");
-    nvs_open_from_partition("nvs", "nvs", NVS_READWRITE, &handle);
-    nvs_set_u8(handle, "fan_mode", mode);
-    nvs_commit(handle);
-    nvs_close(handle);
-
+    settings_set(SETTING_FAN_MODE, mode);
     update_pwm();
 }
 
@@ -0,0 +1,235 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "history.h"
+#include "journal.h"
+#include "measurement.h"
+#include "scheduler.h"
+#include "timesync.h"
+
+struct history_tier
+{
+    uint8_t  *data;
+    uint16_t size;
+    uint16_t interval;
+    uint16_t ratio;
+    uint16_t head;
+    uint16_t count;
+    uint16_t recent;
+    uint32_t timestamp;
+    uint32_t co2_sum;
+    uint32_t pm25_sum;
+    uint16_t samples;
+};
+
+static uint8_t raw_data[3600 / 5 * HISTORY_RECORD_SIZE], minute_data[1440 * HISTORY_RECORD_SIZE], quarter_data[7 * 96 * HISTORY_RECORD_SIZE];
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static struct scheduler_job sample_job;
+static uint32_t restored = 0, restore_time;
+
+static struct history_tier tiers[HISTORY_TIERS] =
+{
+    {raw_data,     sizeof(raw_data)     / HISTORY_RECORD_SIZE, 5,   1,  0, 0, 0, 0, 0, 0, 0},
+    {minute_data,  sizeof(minute_data)  / HISTORY_RECORD_SIZE, 60,  12, 0, 0, 0, 0, 0, 0, 0},
+    {quarter_data, sizeof(quarter_data) / HISTORY_RECORD_SIZE, 900, 15, 0, 0, 0, 0, 0, 0, 0}
+};
+
+static uint8_t *slot(struct history_tier *tier, uint32_t position)
+{
+    return tier->data + position % tier->size * HISTORY_RECORD_SIZE;
+}
+
+static void store(struct history_tier *tier, uint16_t co2, uint16_t pm25)
+{
+    uint8_t *record = slot(tier, tier->head);
+
+    if (co2 > 0x1FFF)
+        co2 = 0x1FFF;
+
+    if (pm25 > 0x07FF)
+        pm25 = 0x07FF;
+
+    record[0] = co2 >> 5;
+    record[1] = (co2 & 0x1F) << 3 | pm25 >> 8;
+    record[2] = pm25 & 0xFF;
+
+    tier->head = (tier->head + 1) % tier->size;
+
+    if (tier->count < tier->size)
+        tier->count++;
+
+    if (tier->recent < tier->size)
+        tier->recent++;
+}
+
+static void push(uint8_t index, uint16_t co2, uint16_t pm25, uint32_t timestamp)
+{
+    struct history_tier *tier = &tiers[index], *next;
+    int32_t gap = timestamp - tier->timestamp;
+
+    if (tier->count && gap > tier->interval * 1500)
+    {
+        uint32_t missing = gap / (tier->interval * 1000) - 1;
+
+        for (uint32_t i = 0; i < missing && i < tier->size; i++)
+            store(tier, 0, 0);
+    }
+
+    store(tier, co2, pm25);
+    tier->timestamp = timestamp;
+
+    if (index + 1 >= HISTORY_TIERS)
+        return;
+
+    next = &tiers[index + 1];
+    next->co2_sum += co2;
+    next->pm25_sum += pm25;
+
+    if (++next->samples < next->ratio)
+        return;
+
+    co2 = (next->co2_sum + next->samples / 2) / next->samples;
+    pm25 = (next->pm25_sum + next->samples / 2) / next->samples;
+
+    next->co2_sum = 0;
+    next->pm25_sum = 0;
+    next->samples = 0;
+
+    push(index + 1, co2, pm25, timestamp);
+}
+
+static void insert_gap(struct history_tier *tier, uint32_t gap)
+{
+    uint32_t missing;
+
+    if (tier->count == tier->recent)
+        return;
+
+    if (gap > (uint32_t) tier->size * tier->interval)
+        gap = (uint32_t) tier->size * tier->interval;
+
+    if (!tier->recent)
+    {
+        tier->timestamp -= gap * 1000;
+        return;
+    }
+
+    missing = gap / tier->interval;
+
+    if (missing > (uint32_t) (tier->size - tier->recent))
+        missing = tier->size - tier->recent;
+
+    for (uint16_t i = 1; i <= tier->recent; i++)
+        memcpy(slot(tier, tier->head + tier->size - i + missing), slot(tier, tier->head + tier->size - i), HISTORY_RECORD_SIZE);
+
+    for (uint32_t i = 0; i < missing; i++)
+        memset(slot(tier, tier->head + tier->size - tier->recent + i), 0, HISTORY_RECORD_SIZE);
+
+    tier->head = (tier->head + missing) % tier->size;
+    tier->count = tier->count + missing < tier->size ? tier->count + missing : tier->size;
+}
+
+static void place_restored(void)
+{
+    int32_t gap = timesync_wall(restore_time) - restored;
+
+    for (uint8_t i = 0; i < HISTORY_TIERS && gap > 0; i++)
+        insert_gap(&tiers[i], gap);
+
+    restored = 0;
+}
+
+static void sample_callback(void)
+{
+    struct history_tier *tier = &tiers[HISTORY_MINUTE];
+    uint16_t head, co2 = measurement_value(MEASUREMENT_CO2), pm25 = measurement_value(MEASUREMENT_PM25);
+    uint8_t record[HISTORY_RECORD_SIZE];
+
+    scheduler_repeat(&sample_job, tiers[HISTORY_RAW].interval * 1000);
+
+    if (!co2 && !pm25)
+        return;
+
+    taskENTER_CRITICAL(&lock);
+
+    if (restored && timesync_valid())
+        place_restored();
+
+    head = tier->head;
+    push(HISTORY_RAW, co2, pm25, timesync_monotonic());
+    memcpy(record, slot(tier, tier->head + tier->size - 1), HISTORY_RECORD_SIZE);
+    taskEXIT_CRITICAL(&lock);
+
+    if (tier->head != head)
+        journal_append(timesync_wall(tier->timestamp), record);
+}
+
+void history_init(void)
+{
+    scheduler_init_job(&sample_job, sample_callback, "history");
+    scheduler_repeat(&sample_job, tiers[HISTORY_RAW].interval * 1000);
+}
+
+void history_restore(uint32_t timestamp, const uint8_t *record)
+{
+    uint32_t gap = restored && (int32_t) (timestamp - restored) > 0 ? timestamp - restored : 0, span = (uint32_t) tiers[HISTORY_QUARTER].size * tiers[HISTORY_QUARTER].interval;
+
+    taskENTER_CRITICAL(&lock);
+
+    if (!restored)
+        restore_time = timesync_monotonic() - tiers[HISTORY_MINUTE].interval * 1000;
+
+    for (uint8_t i = 0; i < HISTORY_TIERS; i++)
+        tiers[i].timestamp -= (gap < span ? gap : span) * 1000;
+
+    push(HISTORY_MINUTE, record[0] << 5 | record[1] >> 3, (record[1] & 0x07) << 8 | record[2], restore_time);
+    restored = timestamp;
+
+    for (uint8_t i = 0; i < HISTORY_TIERS; i++)
+        tiers[i].recent = 0;
+
+    taskEXIT_CRITICAL(&lock);
+}
+
+uint8_t history_read(uint8_t index, uint32_t start, uint8_t count, uint32_t *timestamp, uint8_t *buffer)
+{
+    struct history_tier *tier;
+    uint32_t oldest, skip = 0;
+    uint16_t position;
+
+    if (index >= HISTORY_TIERS || !timesync_valid())
+        return 0;
+
+    tier = &tiers[index];
+    taskENTER_CRITICAL(&lock);
+
+    if (restored)
+        place_restored();
+
+    oldest = timesync_wall(tier->timestamp) - (tier->count - 1) * tier->interval;
+
+    if (start > oldest)
+        skip = (start - oldest + tier->interval - 1) / tier->interval;
+
+    if (!tier->count || skip >= tier->count)
+        count = 0;
+    else if (count > tier->count - skip)
+        count = tier->count - skip;
+
+    *timestamp = oldest + skip * tier->interval;
+    position = (tier->head + tier->size - tier->count + skip) % tier->size;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        memcpy(buffer + i * HISTORY_RECORD_SIZE, slot(tier, position), HISTORY_RECORD_SIZE);
+        position = (position + 1) % tier->size;
+    }
+
+    taskEXIT_CRITICAL(&lock);
+    return count;
+}
+
+uint16_t history_interval(uint8_t index)
+{
+    return index < HISTORY_TIERS ? tiers[index].interval : 0;
+}
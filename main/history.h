@@ -0,0 +1,18 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+#define HISTORY_RAW             0x00
+#define HISTORY_MINUTE          0x01
+#define HISTORY_QUARTER         0x02
+#define HISTORY_TIERS           3
+
+#define HISTORY_RECORD_SIZE     3
+
+void     history_init(void);
+void     history_restore(uint32_t timestamp, const uint8_t *record);
+uint8_t  history_read(uint8_t tier, uint32_t start, uint8_t count, uint32_t *timestamp, uint8_t *buffer);
+uint16_t history_interval(uint8_t tier);
+
+#endif
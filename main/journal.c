@@ -0,0 +1,201 @@
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "config.h"
+#include "crc.h"
+#include "history.h"
+#include "journal.h"
+#include "timesync.h"
+
+#define JOURNAL_MAGIC           0x4C485A56
+#define JOURNAL_MIN_TIMESTAMP   1577836800
+#define SECTOR_SIZE             4096
+#define SECTOR_RECORDS          ((SECTOR_SIZE - sizeof(struct journal_header)) / sizeof(struct journal_record))
+
+struct journal_header
+{
+    uint32_t magic;
+    uint32_t sequence;
+};
+
+struct journal_record
+{
+    uint32_t timestamp;
+    uint8_t  data[HISTORY_RECORD_SIZE];
+    uint8_t  crc;
+};
+
+static const char *tag = "journal";
+static const esp_partition_t *partition = NULL;
+static SemaphoreHandle_t mutex;
+static struct journal_record batch[JOURNAL_BATCH];
+static uint32_t sectors, sector, offset, sequence;
+static uint8_t count = 0;
+
+static bool read_header(uint32_t index, struct journal_header *header)
+{
+    return esp_partition_read(partition, index * SECTOR_SIZE, header, sizeof(*header)) == ESP_OK && header->magic == JOURNAL_MAGIC;
+}
+
+static void open_sector(uint32_t index)
+{
+    struct journal_header header;
+
+    header.magic = JOURNAL_MAGIC;
+    header.sequence = ++sequence;
+
+    esp_partition_erase_range(partition, index * SECTOR_SIZE, SECTOR_SIZE);
+    esp_partition_write(partition, index * SECTOR_SIZE, &header, sizeof(header));
+
+    sector = index;
+    offset = sizeof(header);
+}
+
+static uint32_t find_end(uint32_t index)
+{
+    uint32_t low = 0, high = SECTOR_RECORDS;
+
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2, timestamp;
+
+        if (esp_partition_read(partition, index * SECTOR_SIZE + sizeof(struct journal_header) + middle * sizeof(struct journal_record), &timestamp, sizeof(timestamp)) != ESP_OK || timestamp == 0xFFFFFFFF)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    return low;
+}
+
+static uint32_t replay(uint32_t index, uint32_t length)
+{
+    struct journal_record records[32];
+    uint32_t restored = 0;
+
+    for (uint32_t i = 0; i < length; i += sizeof(records) / sizeof(records[0]))
+    {
+        uint32_t chunk = length - i < sizeof(records) / sizeof(records[0]) ? length - i : sizeof(records) / sizeof(records[0]);
+
+        if (esp_partition_read(partition, index * SECTOR_SIZE + sizeof(struct journal_header) + i * sizeof(struct journal_record), records, chunk * sizeof(struct journal_record)) != ESP_OK)
+            break;
+
+        for (uint32_t j = 0; j < chunk; j++)
+        {
+            if (records[j].timestamp == 0xFFFFFFFF || records[j].crc != crc8(&records[j], offsetof(struct journal_record, crc)))
+                continue;
+
+            history_restore(records[j].timestamp, records[j].data);
+            restored++;
+        }
+    }
+
+    return restored;
+}
+
+void journal_init(void)
+{
+    struct journal_header header;
+    int64_t start = esp_timer_get_time();
+    uint32_t restored = 0;
+    bool found = false;
+
+    mutex = xSemaphoreCreateMutex();
+
+    if (!(partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "history")))
+    {
+        ESP_LOGE(tag, "Partition not found");
+        return;
+    }
+
+    sectors = partition->size / SECTOR_SIZE;
+
+    for (uint32_t i = 0; i < sectors; i++)
+    {
+        if (!read_header(i, &header) || (found && (int32_t) (header.sequence - sequence) <= 0))
+            continue;
+
+        sequence = header.sequence;
+        sector = i;
+        found = true;
+    }
+
+    if (!found)
+    {
+        sequence = 0;
+        open_sector(0);
+        ESP_LOGI(tag, "Partition formatted, %ld sectors of %d records", sectors, (int) SECTOR_RECORDS);
+    }
+    else
+    {
+        offset = sizeof(header) + find_end(sector) * sizeof(struct journal_record);
+
+        for (uint32_t i = 1; i <= sectors; i++)
+        {
+            uint32_t index = (sector + i) % sectors;
+
+            if (index != sector && !read_header(index, &header))
+                continue;
+
+            restored += replay(index, index != sector ? SECTOR_RECORDS : (offset - sizeof(header)) / sizeof(struct journal_record));
+        }
+
+        ESP_LOGI(tag, "Restored %ld records in %lld us, sequence is %ld", restored, esp_timer_get_time() - start, sequence);
+    }
+
+    esp_register_shutdown_handler(journal_flush);
+}
+
+static void write_batch(void)
+{
+    uint8_t written = 0;
+
+    while (written < count)
+    {
+        uint32_t space = (SECTOR_SIZE - offset) / sizeof(struct journal_record), length = (uint32_t) (count - written) < space ? (uint32_t) (count - written) : space;
+
+        if (!space)
+        {
+            open_sector((sector + 1) % sectors);
+            continue;
+        }
+
+        esp_partition_write(partition, sector * SECTOR_SIZE + offset, batch + written, length * sizeof(struct journal_record));
+        offset += length * sizeof(struct journal_record);
+        written += length;
+    }
+
+    count = 0;
+}
+
+void journal_append(uint32_t timestamp, const uint8_t *record)
+{
+    if (!partition || !timesync_valid() || timestamp < JOURNAL_MIN_TIMESTAMP)
+        return;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    batch[count].timestamp = timestamp;
+    memcpy(batch[count].data, record, HISTORY_RECORD_SIZE);
+    batch[count].crc = crc8(&batch[count], offsetof(struct journal_record, crc));
+
+    if (++count >= JOURNAL_BATCH)
+        write_batch();
+
+    xSemaphoreGive(mutex);
+}
+
+void journal_flush(void)
+{
+    if (!partition)
+        return;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    write_batch();
+    xSemaphoreGive(mutex);
+}
@@ -0,0 +1,10 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+void journal_init(void);
+void journal_append(uint32_t timestamp, const uint8_t *record);
+void journal_flush(void);
+
+#endif
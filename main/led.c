@@ -1,46 +1,128 @@
+#include <string.h>
 #include "config.h"
-#include "nvs_flash.h"
 #include "led_strip.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "led.h"
+#include "measurement.h"
 #include "reset.h"
+#include "scheduler.h"
+#include "settings.h"
 #include "zigbee.h"
 
+#define EASE_STEP               0x00
+#define EASE_LINEAR             0x01
+#define EASE_IN                 0x02
+#define EASE_OUT                0x03
+#define EASE_IN_OUT             0x04
+
+#define PRIORITY_GAUGE          0x00
+#define PRIORITY_ALARM          0x01
+#define PRIORITY_PAIRING        0x02
+#define PRIORITY_RESET          0x03
+
+#define GROUP_PM25              0x00
+#define GROUP_ZIGBEE            0x01
+#define GROUP_CO2               0x02
+#define GROUP_COUNT             3
+#define GROUP_SIZE              (LED_COUNT / GROUP_COUNT)
+
+#define GAUGE(min, max)         {min, min + (max - min) / 2, max, (0x100000000ULL + (max - min) / 2 - 1) / ((max - min) / 2), (0x100000000ULL + max - min - (max - min) / 2 - 1) / (max - min - (max - min) / 2)}
+
+struct gauge
+{
+    uint16_t min;
+    uint16_t mid;
+    uint16_t max;
+    uint32_t low_scale;
+    uint32_t high_scale;
+};
+
+struct keyframe
+{
+    uint16_t time;
+    uint8_t  level;
+    uint8_t  easing;
+};
+
+struct track
+{
+    const struct keyframe *frames;
+    uint8_t  count;
+    uint8_t  loop;
+};
+
+struct animation
+{
+    uint8_t  group;
+    uint8_t  priority;
+    uint8_t  raw;
+    const struct track *track;
+    uint8_t  (*active)(void);
+    void     (*color)(uint8_t level, uint8_t *color);
+};
+
+struct group
+{
+    const struct animation *animation;
+    const struct track *track;
+    void     (*color)(uint8_t level, uint8_t *color);
+    uint32_t start;
+    uint8_t  raw;
+    uint8_t  from;
+    uint8_t  level;
+    uint8_t  done;
+};
+
 static const char *tag = "led";
 static led_strip_handle_t led_handle;
-static uint8_t enabled, brightness;
+static struct scheduler_job frame_job;
+static uint8_t enabled, brightness, master = 0, idle = 1, frame[LED_COUNT][3], shown[LED_COUNT][3];
 static uint16_t co2_value = 0, pm25_value = 0;
+static uint32_t rendered = 0, skipped = 0, last = 0;
+static const struct gauge co2_gauge = GAUGE(CO2_MIN_VALUE, CO2_MAX_VALUE), pm25_gauge = GAUGE(PM25_MIN_VALUE, PM25_MAX_VALUE);
 
-static void set_level(uint8_t *level, uint8_t target)
+static const uint8_t gamma_table[256] =
 {
-    if (*level > target)
-        (*level)--;
-    else if (*level < target)
-        (*level)++;
-}
-
-static void set_color(uint16_t min, uint16_t max, uint16_t value, uint8_t level, uint8_t *color)
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 0x06,
+    0x06, 0x07, 0x07, 0x07, 0x08, 0x08, 0x08, 0x09, 0x09, 0x09, 0x0A, 0x0A, 0x0B, 0x0B, 0x0B, 0x0C,
+    0x0C, 0x0D, 0x0D, 0x0D, 0x0E, 0x0E, 0x0F, 0x0F, 0x10, 0x10, 0x11, 0x11, 0x12, 0x12, 0x13, 0x13,
+    0x14, 0x14, 0x15, 0x16, 0x16, 0x17, 0x17, 0x18, 0x19, 0x19, 0x1A, 0x1A, 0x1B, 0x1C, 0x1C, 0x1D,
+    0x1E, 0x1E, 0x1F, 0x20, 0x21, 0x21, 0x22, 0x23, 0x23, 0x24, 0x25, 0x26, 0x27, 0x27, 0x28, 0x29,
+    0x2A, 0x2B, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+    0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F, 0x51, 0x52, 0x53, 0x54, 0x55, 0x57, 0x58, 0x59, 0x5A,
+    0x5B, 0x5D, 0x5E, 0x5F, 0x61, 0x62, 0x63, 0x64, 0x66, 0x67, 0x69, 0x6A, 0x6B, 0x6D, 0x6E, 0x6F,
+    0x71, 0x72, 0x74, 0x75, 0x77, 0x78, 0x79, 0x7B, 0x7C, 0x7E, 0x7F, 0x81, 0x82, 0x84, 0x85, 0x87,
+    0x89, 0x8A, 0x8C, 0x8D, 0x8F, 0x91, 0x92, 0x94, 0x95, 0x97, 0x99, 0x9A, 0x9C, 0x9E, 0x9F, 0xA1,
+    0xA3, 0xA5, 0xA6, 0xA8, 0xAA, 0xAC, 0xAD, 0xAF, 0xB1, 0xB3, 0xB5, 0xB6, 0xB8, 0xBA, 0xBC, 0xBE,
+    0xC0, 0xC2, 0xC4, 0xC5, 0xC7, 0xC9, 0xCB, 0xCD, 0xCF, 0xD1, 0xD3, 0xD5, 0xD7, 0xD9, 0xDB, 0xDD,
+    0xDF, 0xE1, 0xE3, 0xE5, 0xE7, 0xEA, 0xEC, 0xEE, 0xF0, 0xF2, 0xF4, 0xF6, 0xF8, 0xFB, 0xFD, 0xFF
+};
+
+static void set_color(const struct gauge *gauge, uint16_t value, uint8_t level, uint8_t *color)
 {
-    uint16_t mid = min + (max - min) / 2;
-
-    if (value <= min)
+    if (value <= gauge->min)
     {
         color[0] = 0;
         color[1] = level;
     }
-    else if (value >= max)
+    else if (value >= gauge->max)
     {
         color[0] = level;
         color[1] = 0;
     }
-    else if (value < mid)
+    else if (value < gauge->mid)
     {
-        color[0] = (uint8_t) ((float) level / (mid - min) * (value - min));
+        color[0] = (uint64_t) (level * (value - gauge->min)) * gauge->low_scale >> 32;
         color[1] = level;
     }
     else
     {
         color[0] = level;
-        color[1] = (uint8_t) ((float) level / (max - mid) * (max - value));
+        color[1] = (uint64_t) (level * (gauge->max - value)) * gauge->high_scale >> 32;
     }
 }
 
@@ -49,113 +131,281 @@ static void print_log(void)
     ESP_LOGI(tag, "%s, brightness is %d", enabled ? "Enabled" : "Disabled", brightness);
 }
 
-static void led_task(void *arg)
+static void set_pixel(uint8_t index, uint8_t red, uint8_t green, uint8_t blue)
 {
-    (void) arg;
+    frame[index][0] = red;
+    frame[index][1] = green;
+    frame[index][2] = blue;
+}
 
-    led_strip_config_t led_config;
-    led_strip_rmt_config_t rmt_config;
-    uint8_t count = 0, pulse = 1, co2_level = 0, pm25_level = 0, zigbee_level = 0;
+static void refresh(void)
+{
+    if (!memcmp(frame, shown, sizeof(frame)))
+    {
+        skipped++;
+        return;
+    }
 
-    led_config.max_leds = LED_COUNT;
-    led_config.strip_gpio_num = LED_PIN;
-    rmt_config.resolution_hz = 10666666;
+    for (uint8_t i = 0; i < LED_COUNT; i++)
+        led_strip_set_pixel(led_handle, i, frame[i][0], frame[i][1], frame[i][2]);
 
-    led_strip_new_rmt_device(&led_config, &rmt_config, &led_handle);
-    led_strip_clear(led_handle);
+    led_strip_refresh(led_handle);
+    memcpy(shown, frame, sizeof(frame));
+    rendered++;
+}
+
+static const struct keyframe blink_frames[] = {{0, 255, EASE_STEP}, {200, 255, EASE_STEP}, {400, 0, EASE_STEP}};
+static const struct keyframe breathe_frames[] = {{0, 0, EASE_STEP}, {1000, 255, EASE_IN_OUT}, {2000, 0, EASE_IN_OUT}};
+static const struct keyframe fade_in_frames[] = {{0, 0, EASE_STEP}, {LED_FADE_TIME, 255, EASE_OUT}};
+static const struct keyframe fade_out_frames[] = {{0, 255, EASE_STEP}, {LED_FADE_TIME, 0, EASE_IN}};
 
-    while (true)
+static const struct track blink_track = {blink_frames, 3, 1}, breathe_track = {breathe_frames, 3, 1}, fade_in_track = {fade_in_frames, 2, 0}, fade_out_track = {fade_out_frames, 2, 0};
+
+static uint8_t pairing(void)
+{
+    return zigbee_steering() || (!co2_value && !pm25_value);
+}
+
+static uint8_t co2_high(void)
+{
+    return co2_value > CO2_MAX_VALUE;
+}
+
+static uint8_t co2_ready(void)
+{
+    return co2_value ? 1 : 0;
+}
+
+static uint8_t pm25_high(void)
+{
+    return pm25_value > PM25_MAX_VALUE;
+}
+
+static uint8_t pm25_ready(void)
+{
+    return pm25_value ? 1 : 0;
+}
+
+static void red_color(uint8_t level, uint8_t *color)
+{
+    color[0] = level;
+    color[1] = 0;
+    color[2] = 0;
+}
+
+static void blue_color(uint8_t level, uint8_t *color)
+{
+    color[0] = 0;
+    color[1] = 0;
+    color[2] = level;
+}
+
+static void co2_color(uint8_t level, uint8_t *color)
+{
+    set_color(&co2_gauge, co2_value, level, color);
+    color[2] = 0;
+}
+
+static void pm25_color(uint8_t level, uint8_t *color)
+{
+    set_color(&pm25_gauge, pm25_value, level, color);
+    color[2] = 0;
+}
+
+static const struct animation animations[] =
+{
+    {GROUP_ZIGBEE, PRIORITY_RESET,   1, &blink_track,   reset_pending, red_color},
+    {GROUP_ZIGBEE, PRIORITY_PAIRING, 0, &breathe_track, pairing,       blue_color},
+    {GROUP_CO2,    PRIORITY_ALARM,   0, &breathe_track, co2_high,      red_color},
+    {GROUP_CO2,    PRIORITY_GAUGE,   0, &fade_in_track, co2_ready,     co2_color},
+    {GROUP_PM25,   PRIORITY_ALARM,   0, &breathe_track, pm25_high,     red_color},
+    {GROUP_PM25,   PRIORITY_GAUGE,   0, &fade_in_track, pm25_ready,    pm25_color}
+};
+
+static struct group groups[GROUP_COUNT];
+
+static uint32_t get_time(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+static uint16_t ease(uint8_t easing, uint16_t position)
+{
+    switch (easing)
     {
-        if (reset_pending())
+        case EASE_STEP:
+            return 256;
+
+        case EASE_IN:
+            return position * position / 256;
+
+        case EASE_OUT:
+            return 256 - (256 - position) * (256 - position) / 256;
+
+        case EASE_IN_OUT:
+            return position * position * (768 - 2 * position) / 65536;
+
+        default:
+            return position;
+    }
+}
+
+static uint8_t step(struct group *group, uint32_t now)
+{
+    const struct keyframe *frames = group->track->frames;
+    uint32_t elapsed = now - group->start, duration = frames[group->track->count - 1].time;
+    uint8_t looped = 0, from, i = 1;
+
+    if (group->done)
+        return 0;
+
+    if (elapsed >= duration)
+    {
+        if (!group->track->loop)
         {
-            pulse ^= 1;
-            led_strip_set_pixel(led_handle, 2, pulse ? LED_DEFAULT_LEVEL : 0, 0, 0);
-            led_strip_set_pixel(led_handle, 3, pulse ? LED_DEFAULT_LEVEL : 0, 0, 0);
-            led_strip_refresh(led_handle);
-            vTaskDelay(pdMS_TO_TICKS(200));
+            group->level = frames[group->track->count - 1].level;
+            group->done = 1;
+            return 0;
         }
-        else
+
+        elapsed %= duration;
+        looped = 1;
+    }
+
+    while (frames[i].time <= elapsed)
+        i++;
+
+    from = i > 1 || looped ? frames[i - 1].level : group->from;
+    group->level = from + (frames[i].level - from) * ease(frames[i].easing, (elapsed - frames[i - 1].time) * 256 / (frames[i].time - frames[i - 1].time)) / 256;
+    return 1;
+}
+
+static uint8_t render(uint32_t now, uint8_t master)
+{
+    uint8_t active = 0;
+
+    for (uint8_t i = 0; i < GROUP_COUNT; i++)
+    {
+        struct group *group = &groups[i];
+        const struct animation *animation = NULL;
+        uint8_t level, color[3];
+
+        for (uint8_t j = 0; j < sizeof(animations) / sizeof(animations[0]); j++)
+            if (animations[j].group == i && (!animation || animations[j].priority > animation->priority) && animations[j].active())
+                animation = &animations[j];
+
+        if (group->animation != animation)
         {
-            uint8_t color[2];
+            group->animation = animation;
+            group->track = animation ? animation->track : &fade_out_track;
+            group->from = group->level;
+            group->start = now;
+            group->done = 0;
 
-            if (co2_value)
+            if (animation)
             {
-                if (co2_value > CO2_MAX_VALUE)
-                {
-                    set_level(&co2_level, enabled && pulse ? brightness : 0);
-                    led_strip_set_pixel(led_handle, 4, co2_level, 0, 0);
-                    led_strip_set_pixel(led_handle, 5, co2_level, 0, 0);
-                }
-                else
-                {
-                    set_level(&co2_level, enabled ? brightness : 0);
-                    set_color(CO2_MIN_VALUE, CO2_MAX_VALUE, co2_value, co2_level, color);
-                    led_strip_set_pixel(led_handle, 4, color[0], color[1], 0);
-                    led_strip_set_pixel(led_handle, 5, color[0], color[1], 0);
-                }
+                group->color = animation->color;
+                group->raw = animation->raw;
             }
+        }
 
-            if (pm25_value)
-            {
-                if (pm25_value > PM25_MAX_VALUE)
-                {
-                    set_level(&pm25_level, enabled && pulse ? brightness : 0);
-                    led_strip_set_pixel(led_handle, 0, pm25_level, 0, 0);
-                    led_strip_set_pixel(led_handle, 1, pm25_level, 0, 0);
-                }
-                else
-                {
-                    set_level(&pm25_level, enabled ? brightness : 0);
-                    set_color(PM25_MIN_VALUE, PM25_MAX_VALUE, pm25_value, pm25_level, color);
-                    led_strip_set_pixel(led_handle, 0, color[0], color[1], 0);
-                    led_strip_set_pixel(led_handle, 1, color[0], color[1], 0);
-                }
-            }
+        active |= step(group, now);
 
-            if (zigbee_steering() || zigbee_level || (!co2_value && !pm25_value))
-            {
-                set_level(&zigbee_level, enabled && pulse ? brightness : 0);
-                led_strip_set_pixel(led_handle, 2, 0, 0, zigbee_level);
-                led_strip_set_pixel(led_handle, 3, 0, 0, zigbee_level);
-            }
+        if (!group->color)
+            continue;
 
-            if (++count >= 50)
-            {
-                pulse ^= 1;
-                count = 0;
-            }
+        level = group->raw ? (LED_DEFAULT_LEVEL * group->level + 127) / 255 : (brightness * gamma_table[group->level * master / 255] + 127) / 255;
+        group->color(level, color);
 
-            led_strip_refresh(led_handle);
-            vTaskDelay(pdMS_TO_TICKS(20));
-        }
+        for (uint8_t j = 0; j < GROUP_SIZE; j++)
+            set_pixel(i * GROUP_SIZE + j, color[0], color[1], color[2]);
     }
 
-    vTaskDelete(NULL);
+    return active;
 }
 
-void led_init(void)
+static uint8_t fade(uint8_t *level, uint8_t target, uint32_t elapsed)
 {
-    nvs_handle_t handle;
+    uint8_t delta = elapsed < LED_FADE_TIME ? elapsed * 255 / LED_FADE_TIME : 255;
+
+    if (*level == target)
+        return 0;
+
+    if (!delta)
+        delta = 1;
+
+    if (*level > target)
+        *level = *level - target > delta ? *level - delta : target;
+    else
+        *level = target - *level > delta ? *level + delta : target;
+
+    return 1;
+}
+
+static void frame_callback(void)
+{
+    uint32_t now = get_time();
+    uint8_t active;
+
+    if (idle)
+    {
+        last = now;
+        idle = 0;
+    }
+
+    co2_value = measurement_value(MEASUREMENT_CO2);
+    pm25_value = measurement_value(MEASUREMENT_PM25);
 
-    nvs_flash_init_partition("nvs");
-    nvs_open_from_partition("nvs", "nvs", NVS_READONLY, &handle);
+    active = fade(&master, enabled ? 255 : 0, now - last);
+    active |= render(now, master);
+    last = now;
 
-    if (nvs_get_u8(handle, "led_enabled", &enabled) != ESP_OK)
-        enabled = 1;
+    refresh();
+
+    if (active)
+        scheduler_repeat(&frame_job, LED_FRAME_INTERVAL);
+    else
+        idle = 1;
+}
+
+static void measurement_callback(uint8_t type)
+{
+    if (type == MEASUREMENT_CO2 || type == MEASUREMENT_PM25)
+        led_update();
+}
 
-    if (nvs_get_u8(handle, "led_brightness", &brightness) != ESP_OK)
-        brightness = LED_DEFAULT_LEVEL;
+void led_init(void)
+{
+    led_strip_config_t led_config;
+    led_strip_rmt_config_t rmt_config;
 
-    nvs_close(handle);
+    enabled = settings_get(SETTING_LED_ENABLED);
+    brightness = settings_get(SETTING_LED_BRIGHTNESS);
     print_log();
 
-    xTaskCreate(led_task, "led", 4096, NULL, 0, NULL);
+    memset(&led_config, 0, sizeof(led_config));
+    memset(&rmt_config, 0, sizeof(rmt_config));
+
+    led_config.max_leds = LED_COUNT;
+    led_config.strip_gpio_num = LED_PIN;
+    rmt_config.resolution_hz = 10666666;
+
+    led_strip_new_rmt_device(&led_config, &rmt_config, &led_handle);
+    led_strip_clear(led_handle);
+
+    for (uint8_t i = 0; i < GROUP_COUNT; i++)
+    {
+        groups[i].track = &fade_out_track;
+        groups[i].done = 1;
+    }
+
+    scheduler_init_job(&frame_job, frame_callback, "led");
+    scheduler_post(&frame_job);
+    measurement_subscribe(measurement_callback);
 }
 
 void led_set_enabled(uint8_t value)
 {
-    nvs_handle_t handle;
-
     if (enabled == value)
         return;
 
@@ -164,17 +414,12 @@ void led_set_enabled(uint8_t value)
     if (!enabled || brightness)
         print_log();
 
-    nvs_flash_init_partition("nvs");
-    nvs_open_from_partition("nvs", "nvs", NVS_READWRITE, &handle);
-    nvs_set_u8(handle, "led_enabled", enabled);
-    nvs_commit(handle);
-    nvs_close(handle);
+    settings_set(SETTING_LED_ENABLED, enabled);
+    led_update();
 }
 
 void led_set_brightness(uint8_t value)
 {
-    nvs_handle_t handle;
-
     if (brightness == value)
         return;
 
@@ -183,21 +428,13 @@ void led_set_brightness(uint8_t value)
     if (brightness)
         print_log();
 
-    nvs_flash_init_partition("nvs");
-    nvs_open_from_partition("nvs", "nvs", NVS_READWRITE, &handle);
-    nvs_set_u8(handle, "led_brightness", brightness);
-    nvs_commit(handle);
-    nvs_close(handle);
+    settings_set(SETTING_LED_BRIGHTNESS, brightness);
+    led_update();
 }
 
-void led_set_co2(uint16_t value)
+void led_update(void)
 {
-    co2_value = value;
-}
-
-void led_set_pm25(uint16_t value)
-{
-    pm25_value = value;
+    scheduler_post(&frame_job);
 }
 
 uint8_t led_enabled(void)
@@ -208,4 +445,14 @@ uint8_t led_enabled(void)
 uint8_t led_brightness(void)
 {
     return brightness;
+}
+
+uint32_t led_frames_rendered(void)
+{
+    return rendered;
+}
+
+uint32_t led_frames_skipped(void)
+{
+    return skipped;
 }
\ No newline at end of file
@@ -3,12 +3,13 @@
 
 #include <stdint.h>
 
-void    led_init(void);
-void    led_set_enabled(uint8_t value);
-void    led_set_brightness(uint8_t value);
-void    led_set_co2(uint16_t value);
-void    led_set_pm25(uint16_t value);
-uint8_t led_enabled(void);
-uint8_t led_brightness(void);
+void     led_init(void);
+void     led_set_enabled(uint8_t value);
+void     led_set_brightness(uint8_t value);
+void     led_update(void);
+uint8_t  led_enabled(void);
+uint8_t  led_brightness(void);
+uint32_t led_frames_rendered(void);
+uint32_t led_frames_skipped(void);
 
 #endif
@@ -1,17 +1,31 @@
 #include "nvs_flash.h"
+#include "diagnostics.h"
 #include "fan.h"
+#include "history.h"
+#include "journal.h"
 #include "led.h"
+#include "offline.h"
 #include "pm1006.h"
 #include "reset.h"
 #include "scd40.h"
+#include "scheduler.h"
+#include "settings.h"
+#include "timesync.h"
 #include "zigbee.h"
 
 void app_main(void)
 {
     nvs_flash_init();
+    settings_init();
+    scheduler_init();
+    timesync_init();
+    diagnostics_init();
     reset_init();
     led_init();
     fan_init();
+    history_init();
+    journal_init();
+    offline_init();
     scd40_init();
     pm1006_init();
     zigbee_init();
@@ -0,0 +1,79 @@
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "measurement.h"
+#include "timesync.h"
+
+#define MAX_SUBSCRIBERS         4
+
+struct measurement_slot
+{
+    atomic_uint        sequence;
+    struct measurement samples[2];
+};
+
+static const char *tag = "measurement";
+static struct measurement_slot slots[MEASUREMENT_COUNT];
+static void (*subscribers[MAX_SUBSCRIBERS])(uint8_t type);
+static atomic_uint subscriber_count;
+
+void measurement_publish(uint8_t type, int32_t value)
+{
+    struct measurement_slot *slot;
+    uint32_t sequence, count;
+
+    if (type >= MEASUREMENT_COUNT)
+        return;
+
+    slot = &slots[type];
+    sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed) + 1;
+
+    slot->samples[sequence & 1].value = value;
+    slot->samples[sequence & 1].timestamp = timesync_monotonic();
+
+    atomic_store_explicit(&slot->sequence, sequence, memory_order_release);
+    count = atomic_load_explicit(&subscriber_count, memory_order_acquire);
+
+    for (uint32_t i = 0; i < count; i++)
+        subscribers[i](type);
+}
+
+void measurement_subscribe(void (*callback)(uint8_t type))
+{
+    uint32_t count = atomic_load_explicit(&subscriber_count, memory_order_relaxed);
+
+    if (count >= MAX_SUBSCRIBERS)
+    {
+        ESP_LOGE(tag, "Too many subscribers");
+        return;
+    }
+
+    subscribers[count] = callback;
+    atomic_store_explicit(&subscriber_count, count + 1, memory_order_release);
+}
+
+uint8_t measurement_read(uint8_t type, struct measurement *sample)
+{
+    struct measurement_slot *slot;
+    uint32_t sequence;
+
+    if (type >= MEASUREMENT_COUNT)
+        return 0;
+
+    slot = &slots[type];
+
+    do
+    {
+        sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        *sample = slot->samples[sequence & 1];
+        atomic_thread_fence(memory_order_acquire);
+    }
+    while (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != sequence);
+
+    return sequence ? 1 : 0;
+}
+
+int32_t measurement_value(uint8_t type)
+{
+    struct measurement sample;
+    return measurement_read(type, &sample) ? sample.value : 0;
+}
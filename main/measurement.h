@@ -0,0 +1,23 @@
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+
+#include <stdint.h>
+
+#define MEASUREMENT_CO2             0x00
+#define MEASUREMENT_PM25            0x01
+#define MEASUREMENT_TEMPERATURE     0x02
+#define MEASUREMENT_HUMIDITY        0x03
+#define MEASUREMENT_COUNT           4
+
+struct measurement
+{
+    int32_t  value;
+    uint32_t timestamp;
+};
+
+void     measurement_publish(uint8_t type, int32_t value);
+void     measurement_subscribe(void (*callback)(uint8_t type));
+uint8_t  measurement_read(uint8_t type, struct measurement *sample);
+int32_t  measurement_value(uint8_t type);
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_random.h"
+#include "config.h"
+#include "measurement.h"
+#include "offline.h"
+#include "scheduler.h"
+#include "timesync.h"
+#include "zigbee.h"
+
+#define DELIVERY_PENDING        0
+#define DELIVERY_SUCCESS        1
+#define DELIVERY_FAILED         2
+
+struct offline_bucket
+{
+    uint32_t start;
+    uint32_t end;
+    int32_t  sum[MEASUREMENT_COUNT];
+    int32_t  min[MEASUREMENT_COUNT];
+    int32_t  max[MEASUREMENT_COUNT];
+    uint16_t count[MEASUREMENT_COUNT];
+};
+
+static const char *tag = "offline";
+static struct offline_bucket buckets[OFFLINE_BUCKETS];
+static struct scheduler_job flush_job;
+static atomic_int delivery;
+static uint32_t dropped = 0;
+static uint8_t head = 0, length = 0, sending = 0;
+
+static void put_value(uint8_t *data, uint32_t value, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; i++)
+        data[i] = value >> (8 * i) & 0xFF;
+}
+
+static void measurement_callback(uint8_t type)
+{
+    struct offline_bucket *bucket = length ? &buckets[(head + length - 1) % OFFLINE_BUCKETS] : NULL;
+    struct measurement sample;
+
+    if (zigbee_connected() || !measurement_read(type, &sample))
+        return;
+
+    if (!bucket || (sending && length == 1) || sample.timestamp - bucket->start >= OFFLINE_WINDOW)
+    {
+        if (length == OFFLINE_BUCKETS)
+        {
+            head = (head + 1) % OFFLINE_BUCKETS;
+            sending = 0;
+            length--;
+            dropped++;
+        }
+
+        bucket = &buckets[(head + length++) % OFFLINE_BUCKETS];
+        memset(bucket, 0, sizeof(*bucket));
+        bucket->start = sample.timestamp;
+    }
+
+    if (!bucket->count[type] || sample.value < bucket->min[type])
+        bucket->min[type] = sample.value;
+
+    if (!bucket->count[type] || sample.value > bucket->max[type])
+        bucket->max[type] = sample.value;
+
+    bucket->sum[type] += sample.value;
+    bucket->count[type]++;
+    bucket->end = sample.timestamp;
+}
+
+static void send_bucket(void)
+{
+    struct offline_bucket *bucket = &buckets[head];
+    uint8_t payload[8 + MEASUREMENT_COUNT * 15], *data = payload + 8;
+    uint32_t timestamp = timesync_wall(bucket->start);
+    uint16_t duration = (bucket->end - bucket->start) / 1000;
+
+    put_value(payload + 1, timestamp, 4);
+    put_value(payload + 5, duration, 2);
+    payload[7] = 0;
+
+    for (uint8_t type = 0; type < MEASUREMENT_COUNT; type++)
+    {
+        if (!bucket->count[type])
+            continue;
+
+        data[0] = type;
+        put_value(data + 1, bucket->count[type], 2);
+        put_value(data + 3, bucket->min[type], 4);
+        put_value(data + 7, bucket->max[type], 4);
+        put_value(data + 11, (bucket->sum[type] + bucket->count[type] / 2) / bucket->count[type], 4);
+
+        data += 15;
+        payload[7]++;
+    }
+
+    payload[0] = data - payload - 1;
+    atomic_store(&delivery, DELIVERY_PENDING);
+    sending = zigbee_send_summary(payload);
+
+    if (sending)
+        ESP_LOGI(tag, "Sending summary of %d s starting at %ld, %d buckets buffered", duration, timestamp, length);
+}
+
+static void flush_callback(void)
+{
+    if (sending)
+    {
+        sending = 0;
+
+        if (atomic_load(&delivery) == DELIVERY_SUCCESS)
+        {
+            head = (head + 1) % OFFLINE_BUCKETS;
+            length--;
+        }
+        else
+        {
+            ESP_LOGW(tag, "Summary was not delivered, keeping it");
+        }
+    }
+
+    if (!length || !zigbee_connected())
+        return;
+
+    if (dropped)
+    {
+        ESP_LOGW(tag, "Dropped %ld oldest buckets while offline", dropped);
+        dropped = 0;
+    }
+
+    if (timesync_valid())
+        send_bucket();
+
+    scheduler_delay(&flush_job, OFFLINE_FLUSH_INTERVAL);
+}
+
+void offline_init(void)
+{
+    scheduler_init_job(&flush_job, flush_callback, "offline");
+    measurement_subscribe(measurement_callback);
+}
+
+void offline_flush(void)
+{
+    scheduler_delay(&flush_job, OFFLINE_FLUSH_INTERVAL + esp_random() % OFFLINE_FLUSH_JITTER);
+}
+
+void offline_delivered(bool success)
+{
+    atomic_store(&delivery, success ? DELIVERY_SUCCESS : DELIVERY_FAILED);
+}
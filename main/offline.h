@@ -0,0 +1,10 @@
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+#include <stdbool.h>
+
+void    offline_init(void);
+void    offline_flush(void);
+void    offline_delivered(bool success);
+
+#endif
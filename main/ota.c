@@ -0,0 +1,521 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mbedtls/sha256.h"
+#include "config.h"
+#include "ota.h"
+#include "scheduler.h"
+#include "settings.h"
+
+#define SECTOR_SIZE             4096
+#define HASH_SIZE               32
+#define HASH_CHUNK              16384
+
+#define PATCH_MAGIC             "VZD1"
+#define PATCH_HEADER_SIZE       44
+#define PATCH_MAX_COPY          1024
+#define PATCH_COPY              0x00
+#define PATCH_LITERAL           0x01
+
+#define STATE_HEADER            0x00
+#define STATE_OPCODE            0x01
+#define STATE_COPY              0x02
+#define STATE_LENGTH            0x03
+#define STATE_LITERAL           0x04
+
+struct ota_checkpoint
+{
+    uint32_t version;
+    uint32_t size;
+    uint32_t offset;
+};
+
+struct patch_decoder
+{
+    uint8_t  buffer[PATCH_HEADER_SIZE];
+    uint8_t  count;
+    uint8_t  state;
+    uint32_t remaining;
+};
+
+static const char *tag = "ota";
+static const esp_partition_t *partition = NULL, *source = NULL;
+static SemaphoreHandle_t mutex;
+static struct scheduler_job hash_job;
+static mbedtls_sha256_context sha;
+static struct ota_checkpoint checkpoint;
+static struct patch_decoder decoder;
+static uint8_t hash[HASH_SIZE], resumed = 0, delta = 0;
+static uint32_t image_size, offset, erased, hashed, received, saved, source_size;
+static int64_t start_time;
+
+static uint32_t get_u32(const uint8_t *data)
+{
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24;
+}
+
+static void save_checkpoint(void)
+{
+    checkpoint.offset = received;
+    saved = received;
+    settings_set_blob("ota", &checkpoint, sizeof(checkpoint));
+}
+
+static void clear_checkpoint(void)
+{
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    settings_set_blob("ota", NULL, 0);
+}
+
+static void update_hash(const uint8_t *data, uint32_t size, uint32_t position)
+{
+    uint32_t limit = image_size - HASH_SIZE, length = 0;
+
+    if (position < limit)
+        length = limit - position < size ? limit - position : size;
+
+    if (length)
+        mbedtls_sha256_update(&sha, data, length);
+
+    if (size > length)
+        memcpy(hash + position + length - limit, data + length, size - length);
+}
+
+static void reset_state(void)
+{
+    mbedtls_sha256_free(&sha);
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    memset(&decoder, 0, sizeof(decoder));
+
+    offset = 0;
+    erased = 0;
+    hashed = 0;
+    received = 0;
+    saved = 0;
+    delta = 0;
+}
+
+static esp_err_t restore_hash(uint32_t end)
+{
+    uint8_t buffer[256];
+
+    while (hashed < end)
+    {
+        uint32_t length = end - hashed < sizeof(buffer) ? end - hashed : sizeof(buffer);
+
+        if (esp_partition_read(partition, hashed, buffer, length) != ESP_OK)
+            return ESP_FAIL;
+
+        update_hash(buffer, length, hashed);
+        hashed += length;
+    }
+
+    return ESP_OK;
+}
+
+static void hash_callback(void)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if (partition && hashed < offset)
+    {
+        if (restore_hash(offset - hashed < HASH_CHUNK ? offset : hashed + HASH_CHUNK) != ESP_OK)
+        {
+            ESP_LOGE(tag, "Reading the update partition failed, discarding the checkpoint");
+            clear_checkpoint();
+            partition = NULL;
+        }
+        else if (hashed < offset)
+            scheduler_post(&hash_job);
+        else
+            ESP_LOGI(tag, "Hash restored in %lld ms", (esp_timer_get_time() - start_time) / 1000);
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+static uint8_t restarted(const uint8_t *data, uint32_t size)
+{
+    uint8_t buffer[OTA_MAX_DATA_SIZE];
+
+    if (size > sizeof(buffer) || esp_partition_read(partition, 0, buffer, size) != ESP_OK)
+        return 0;
+
+    return !memcmp(buffer, data, size);
+}
+
+static esp_err_t write_image(const uint8_t *data, uint32_t size)
+{
+    esp_err_t result;
+
+    if (offset + size > image_size)
+        return ESP_ERR_INVALID_SIZE;
+
+    while (erased < offset + size)
+    {
+        if ((result = esp_partition_erase_range(partition, erased, SECTOR_SIZE)) != ESP_OK)
+            return result;
+
+        erased += SECTOR_SIZE;
+    }
+
+    if ((result = esp_partition_write(partition, offset, data, size)) != ESP_OK)
+        return result;
+
+    if (hashed == offset)
+    {
+        update_hash(data, size, offset);
+        hashed += size;
+    }
+
+    offset += size;
+    return ESP_OK;
+}
+
+static esp_err_t verify_source(const uint8_t *expected)
+{
+    uint8_t digest[HASH_SIZE];
+
+    if (source_size <= HASH_SIZE || esp_partition_read(source, source_size - HASH_SIZE, digest, HASH_SIZE) != ESP_OK)
+        return ESP_ERR_INVALID_SIZE;
+
+    return memcmp(digest, expected, HASH_SIZE) ? ESP_ERR_INVALID_CRC : ESP_OK;
+}
+
+static esp_err_t copy_source(uint32_t position, uint32_t length)
+{
+    uint8_t buffer[256];
+    esp_err_t result;
+
+    if (length > PATCH_MAX_COPY || position > source_size || length > source_size - position)
+        return ESP_ERR_INVALID_ARG;
+
+    while (length)
+    {
+        uint32_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+
+        if ((result = esp_partition_read(source, position, buffer, chunk)) != ESP_OK || (result = write_image(buffer, chunk)) != ESP_OK)
+            return result;
+
+        position += chunk;
+        length -= chunk;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t parse_header(void)
+{
+    uint32_t size = get_u32(decoder.buffer + 4);
+
+    source = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, NULL);
+    source_size = get_u32(decoder.buffer + 8);
+
+    if (size <= HASH_SIZE || size > partition->size || !source || source == partition || source_size > source->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (verify_source(decoder.buffer + 12) != ESP_OK)
+    {
+        ESP_LOGE(tag, "Patch does not match the factory image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    image_size = size;
+    ESP_LOGI(tag, "Applying patch, image size is %ld bytes, source size is %ld bytes", image_size, source_size);
+    return ESP_OK;
+}
+
+static uint8_t collect(const uint8_t **data, uint32_t *size, uint8_t count)
+{
+    while (*size && decoder.count < count)
+    {
+        decoder.buffer[decoder.count++] = **data;
+        (*data)++;
+        (*size)--;
+    }
+
+    if (decoder.count < count)
+        return 0;
+
+    decoder.count = 0;
+    return 1;
+}
+
+static esp_err_t apply_patch(const uint8_t *data, uint32_t size)
+{
+    esp_err_t result = ESP_OK;
+
+    while (size && result == ESP_OK)
+    {
+        switch (decoder.state)
+        {
+            case STATE_HEADER:
+
+                if (collect(&data, &size, PATCH_HEADER_SIZE))
+                {
+                    result = parse_header();
+                    decoder.state = STATE_OPCODE;
+                }
+
+                break;
+
+            case STATE_OPCODE:
+
+                if (!collect(&data, &size, 1))
+                    break;
+
+                switch (decoder.buffer[0])
+                {
+                    case PATCH_COPY:    decoder.state = STATE_COPY; break;
+                    case PATCH_LITERAL: decoder.state = STATE_LENGTH; break;
+                    default:            result = ESP_ERR_INVALID_ARG; break;
+                }
+
+                break;
+
+            case STATE_COPY:
+
+                if (collect(&data, &size, 8))
+                {
+                    result = copy_source(get_u32(decoder.buffer), get_u32(decoder.buffer + 4));
+                    decoder.state = STATE_OPCODE;
+                }
+
+                break;
+
+            case STATE_LENGTH:
+
+                if (collect(&data, &size, 4))
+                {
+                    decoder.remaining = get_u32(decoder.buffer);
+                    decoder.state = decoder.remaining ? STATE_LITERAL : STATE_OPCODE;
+                }
+
+                break;
+
+            case STATE_LITERAL:
+            {
+                uint32_t length = decoder.remaining < size ? decoder.remaining : size;
+
+                result = write_image(data, length);
+                decoder.remaining -= length;
+                data += length;
+                size -= length;
+
+                if (!decoder.remaining)
+                    decoder.state = STATE_OPCODE;
+
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+void ota_init(void)
+{
+    mutex = xSemaphoreCreateMutex();
+    scheduler_init_job(&hash_job, hash_callback, "ota hash");
+
+    if (!settings_get_blob("ota", &checkpoint, sizeof(checkpoint)))
+        memset(&checkpoint, 0, sizeof(checkpoint));
+}
+
+uint8_t ota_checkpoint(uint32_t *version, uint32_t *position)
+{
+    if (!checkpoint.offset)
+        return 0;
+
+    *version = checkpoint.version;
+    *position = checkpoint.offset;
+    return 1;
+}
+
+static esp_err_t start_image(uint32_t version, uint32_t size)
+{
+    partition = esp_ota_get_next_update_partition(NULL);
+
+    if (!partition || partition == esp_ota_get_running_partition())
+    {
+        ESP_LOGE(tag, "No update partition available besides the running one");
+        partition = NULL;
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    }
+
+    if (size <= HASH_SIZE || size > partition->size)
+    {
+        ESP_LOGE(tag, "Image size %ld is not valid", size);
+        partition = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    reset_state();
+    start_time = esp_timer_get_time();
+    image_size = size;
+
+    if (checkpoint.version == version && checkpoint.size == size && checkpoint.offset && checkpoint.offset < size)
+    {
+        offset = checkpoint.offset;
+        erased = (offset + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+        received = offset;
+        saved = offset;
+        resumed = 1;
+
+        scheduler_post(&hash_job);
+        ESP_LOGI(tag, "Resuming version 0x%08lx at %ld/%ld bytes", version, offset, size);
+        return ESP_OK;
+    }
+
+    checkpoint.version = version;
+    checkpoint.size = size;
+    checkpoint.offset = 0;
+    resumed = 0;
+
+    ESP_LOGI(tag, "Downloading version 0x%08lx, %ld bytes", version, size);
+    return ESP_OK;
+}
+
+static esp_err_t write_block(const uint8_t *data, uint32_t size)
+{
+    esp_err_t result;
+
+    if (!partition)
+        return ESP_ERR_INVALID_STATE;
+
+    if (resumed)
+    {
+        resumed = 0;
+
+        if (restarted(data, size))
+        {
+            ESP_LOGW(tag, "Server restarted the transfer from the beginning");
+            reset_state();
+        }
+    }
+
+    if (received + size > checkpoint.size)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (!received && size >= 4 && !memcmp(data, PATCH_MAGIC, 4))
+    {
+        ESP_LOGI(tag, "Delta image, resume is disabled");
+        delta = 1;
+    }
+
+    if ((result = delta ? apply_patch(data, size) : write_image(data, size)) != ESP_OK)
+        return result;
+
+    received += size;
+
+    if (received - saved >= OTA_CHECKPOINT)
+    {
+        ESP_LOGI(tag, "Received %ld/%ld bytes", received, checkpoint.size);
+
+        if (!delta)
+            save_checkpoint();
+        else
+            saved = received;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t check_image(void)
+{
+    uint8_t digest[HASH_SIZE];
+    int64_t time = (esp_timer_get_time() - start_time) / 1000;
+
+    if (!partition || received != checkpoint.size || offset != image_size || (delta && decoder.state != STATE_OPCODE))
+    {
+        ESP_LOGE(tag, "Image incomplete, received %ld/%ld bytes, written %ld/%ld bytes", received, checkpoint.size, offset, image_size);
+        return ESP_FAIL;
+    }
+
+    if (restore_hash(offset) != ESP_OK)
+    {
+        ESP_LOGE(tag, "Reading the update partition failed");
+        return ESP_FAIL;
+    }
+
+    mbedtls_sha256_finish(&sha, digest);
+
+    if (memcmp(digest, hash, HASH_SIZE))
+    {
+        ESP_LOGE(tag, "Image hash mismatch");
+        clear_checkpoint();
+        partition = NULL;
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(tag, "Image verified, %ld bytes received in %lld ms (%lld bytes/s), %ld bytes written", received, time, time ? received * 1000LL / time : 0, offset);
+    return ESP_OK;
+}
+
+esp_err_t ota_start(uint32_t version, uint32_t size)
+{
+    esp_err_t result;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    result = start_image(version, size);
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+esp_err_t ota_write(const uint8_t *data, uint32_t size)
+{
+    esp_err_t result;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    result = write_block(data, size);
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+esp_err_t ota_check(void)
+{
+    esp_err_t result;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    result = check_image();
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+esp_err_t ota_finish(void)
+{
+    esp_err_t result = ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if (partition)
+    {
+        if ((result = esp_ota_set_boot_partition(partition)) != ESP_OK)
+            ESP_LOGE(tag, "Set boot partition failed, status: %s", esp_err_to_name(result));
+
+        clear_checkpoint();
+        partition = NULL;
+    }
+
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+void ota_abort(void)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if (partition)
+    {
+        if (!delta)
+            save_checkpoint();
+
+        ESP_LOGW(tag, "Download aborted at %ld/%ld bytes", received, checkpoint.size);
+    }
+
+    xSemaphoreGive(mutex);
+}
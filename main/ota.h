@@ -0,0 +1,15 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+void      ota_init(void);
+uint8_t   ota_checkpoint(uint32_t *version, uint32_t *position);
+esp_err_t ota_start(uint32_t version, uint32_t size);
+esp_err_t ota_write(const uint8_t *data, uint32_t size);
+esp_err_t ota_check(void);
+esp_err_t ota_finish(void);
+void      ota_abort(void);
+
+#endif
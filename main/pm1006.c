@@ -1,63 +1,176 @@
 #include <string.h>
 #include "driver/uart.h"
 #include "esp_log.h"
-#include "esp_zigbee_core.h"
 #include "config.h"
-#include "led.h"
-#include "zigbee.h"
+#include "measurement.h"
+#include "pm1006.h"
+#include "scheduler.h"
+
+struct pm1006_parser
+{
+    uint8_t  buffer[PM1006_FRAME_LENGTH];
+    uint8_t  length;
+    uint8_t  checksum;
+    uint32_t frames;
+    uint32_t errors;
+    void     (*callback)(const uint8_t *frame);
+};
 
 static const char *tag = "pm1006";
+static const uint8_t header[3] = {0x16, 0x11, 0x0B};
+static const uint8_t command[5] = {0x11, 0x02, 0x0B, 0x01, 0xE1};
+static struct pm1006_parser parser;
+static struct scheduler_job poll_job, read_job;
+static QueueHandle_t queue;
+static uint32_t sum = 0, errors = 0, missed = 0;
+static uint16_t count = 0;
+static uint8_t pending = 0;
 
-static void pm1006_task(void *arg)
+static void parse_byte(uint8_t byte)
 {
-    (void) arg;
+    if (parser.length < sizeof(header) && byte != header[parser.length])
+    {
+        parser.length = 0;
+        parser.checksum = 0;
 
-    uart_config_t config;
-    TickType_t tick = xTaskGetTickCount();
-    uint8_t command[5] = {0x11, 0x02, 0x0B, 0x01, 0xE1}, header[3] = {0x16, 0x11, 0x0B}, buffer[256], length;
+        if (byte != header[0])
+            return;
+    }
 
-    memset(&config, 0, sizeof(config));
+    parser.buffer[parser.length++] = byte;
+    parser.checksum += byte;
 
-    config.baud_rate = 9600;
-    config.data_bits = UART_DATA_8_BITS;
-    config.stop_bits = UART_STOP_BITS_1;
+    if (parser.length < PM1006_FRAME_LENGTH)
+        return;
 
-    uart_driver_install(UART_PORT, sizeof(buffer), 0, 0, NULL, 0);
-    uart_param_config(UART_PORT, &config);
-    uart_set_pin(UART_PORT, UART_TX_PIN, UART_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    parser.length = 0;
 
-    while (true)
+    if (parser.checksum)
     {
-        vTaskDelayUntil(&tick, pdMS_TO_TICKS(5000));
-
-        uart_write_bytes(UART_PORT, command, sizeof(command));
-        uart_wait_tx_done(UART_PORT, pdMS_TO_TICKS(1000));
+        parser.checksum = 0;
+        parser.errors++;
 
-        if ((length = uart_read_bytes(UART_PORT, buffer, sizeof(buffer) - 1, pdMS_TO_TICKS(1000))) == 20 && !memcmp(buffer, header, sizeof(header)))
-        {
-            uint8_t checksum = 0;
+        for (uint8_t i = 1; i < PM1006_FRAME_LENGTH; i++)
+            parse_byte(parser.buffer[i]);
 
-            for (uint8_t i = 0; i < 20; i++)
-                checksum += buffer[i];
+        return;
+    }
 
-            if (!checksum)
-            {
-                float value = buffer[5] << 8 | buffer[6];
+    parser.frames++;
+    parser.callback(parser.buffer);
+}
 
-                if (!zigbee_steering())
-                    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_PM2_5_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_PM2_5_MEASUREMENT_MEASURED_VALUE_ID, &value, false);
+static void frame_callback(const uint8_t *frame)
+{
+    sum += frame[5] << 8 | frame[6];
+    count++;
+}
 
-                ESP_LOGI(tag, "PM25 is %.0f µg/m³", value);
-                led_set_pm25((uint16_t) value);
-                continue;
-            }
-        }
+static void report(void)
+{
+    uint16_t value;
 
+    if (!count)
+    {
+#if PM1006_PASSIVE_MODE
+        if (!(missed++ % 60))
+            ESP_LOGW(tag, "No data received for %ld s", missed * PM1006_INTERVAL / 1000);
+#else
         ESP_LOGE(tag, "Data request failed");
+#endif
+        return;
     }
+
+    missed = 0;
+
+    value = (sum + count / 2) / count;
+
+    ESP_LOGI(tag, "PM25 is %d µg/m³ (%d samples)", value, count);
+    measurement_publish(MEASUREMENT_PM25, value);
+
+    sum = 0;
+    count = 0;
+}
+
+static void read_data(void)
+{
+    uart_event_t event;
+    uint8_t buffer[128];
+    size_t size = 0;
+
+    while (xQueueReceive(queue, &event, 0))
+    {
+        if (event.type != UART_FIFO_OVF && event.type != UART_BUFFER_FULL)
+            continue;
+
+        ESP_LOGW(tag, "RX buffer overflow");
+        uart_flush_input(UART_PORT);
+        xQueueReset(queue);
+        return;
+    }
+
+    uart_get_buffered_data_len(UART_PORT, &size);
+
+    while (size)
+    {
+        int length = uart_read_bytes(UART_PORT, buffer, size < sizeof(buffer) ? size : sizeof(buffer), 0);
+
+        if (length <= 0)
+            break;
+
+        for (int i = 0; i < length; i++)
+            parse_byte(buffer[i]);
+
+        size -= length;
+    }
+
+    if (parser.errors != errors)
+        ESP_LOGW(tag, "Dropped %ld frames with invalid checksum", parser.errors - errors);
+
+    errors = parser.errors;
+}
+
+static void read_callback(void)
+{
+    read_data();
+    report();
+}
+
+static void poll_callback(void)
+{
+    scheduler_repeat(&poll_job, PM1006_INTERVAL);
+
+    if (!PM1006_PASSIVE_MODE)
+    {
+        uart_write_bytes(UART_PORT, command, sizeof(command));
+        scheduler_delay(&read_job, PM1006_RESPONSE_TIME);
+        return;
+    }
+
+    read_data();
+
+    if (pending)
+        report();
+
+    pending = 1;
 }
 
 void pm1006_init(void)
 {
-    xTaskCreate(pm1006_task, "pm1006", 4096, NULL, 0, NULL);
+    uart_config_t config;
+
+    memset(&config, 0, sizeof(config));
+
+    config.baud_rate = 9600;
+    config.data_bits = UART_DATA_8_BITS;
+    config.stop_bits = UART_STOP_BITS_1;
+
+    uart_driver_install(UART_PORT, 512, 0, 8, &queue, 0);
+    uart_param_config(UART_PORT, &config);
+    uart_set_pin(UART_PORT, PM1006_PASSIVE_MODE ? UART_PIN_NO_CHANGE : UART_TX_PIN, UART_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+
+    parser.callback = frame_callback;
+    scheduler_init_job(&poll_job, poll_callback, "pm1006");
+    scheduler_init_job(&read_job, read_callback, "pm1006 read");
+    scheduler_post(&poll_job);
 }
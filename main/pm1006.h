@@ -1,6 +1,8 @@
 #ifndef PM1006_H
 #define PM1006_H
 
+#define PM1006_FRAME_LENGTH     20
+
 void pm1006_init(void);
 
 #endif
@@ -1,38 +1,52 @@
 #include <string.h>
 #include "driver/gpio.h"
-#include "driver/gptimer.h"
 #include "esp_log.h"
 #include "esp_zigbee_core.h"
-#include "nvs_flash.h"
 #include "config.h"
 #include "reset.h"
+#include "scheduler.h"
+#include "settings.h"
 
 static const char *tag = "reset";
-static TaskHandle_t button_handle, timer_handle;
-static gptimer_handle_t timer;
+static struct scheduler_job button_job, hold_job, reset_job;
 static uint8_t count, reset_flag = 0;
 
 static void IRAM_ATTR button_handler(void *arg)
 {
     (void) arg;
-    xTaskResumeFromISR(button_handle);
+    scheduler_post_from_isr(&button_job);
 }
 
-static bool IRAM_ATTR timer_handler(gptimer_handle_t timer, const gptimer_alarm_event_data_t *event, void *arg)
+static void button_callback(void)
 {
-    (void) event;
-    (void) arg;
-    gptimer_stop(timer);
-    xTaskResumeFromISR(timer_handle);
-    return true;
+    if (gpio_get_level(BUTTON_PIN))
+        scheduler_cancel(&hold_job);
+    else if (!hold_job.armed)
+        scheduler_delay(&hold_job, RESET_TIMEOUT);
 }
 
-static void button_task(void *arg)
+static void hold_callback(void)
 {
-    (void) arg;
+    reset_update_count(0);
+    reset_to_factory();
+}
+
+static void reset_callback(void)
+{
+    if (!reset_flag)
+    {
+        reset_update_count(0);
+        return;
+    }
+
+    reset_to_factory();
+}
 
+void reset_init(void)
+{
     gpio_config_t config;
-    uint8_t check = 0;
+
+    count = settings_get(SETTING_RESET_COUNT) + 1;
 
     memset(&config, 0, sizeof(config));
     config.pin_bit_mask = 1ULL << BUTTON_PIN;
@@ -40,63 +54,14 @@ static void button_task(void *arg)
     config.pull_up_en = GPIO_PULLUP_ENABLE;
     config.intr_type = GPIO_INTR_ANYEDGE;
 
+    scheduler_init_job(&button_job, button_callback, "button");
+    scheduler_init_job(&hold_job, hold_callback, "hold");
+    scheduler_init_job(&reset_job, reset_callback, "reset");
+
     gpio_config(&config);
     gpio_install_isr_service(0);
     gpio_isr_handler_add(BUTTON_PIN, button_handler, NULL);
 
-    while (true)
-    {
-        vTaskSuspend(NULL);
-
-        if (gpio_get_level(BUTTON_PIN))
-        {
-            if (!check)
-                continue;
-
-            gptimer_stop(timer);
-            check = 0;
-        }
-        else if (!check)
-        {
-            gptimer_set_raw_count(timer, 0);
-            gptimer_start(timer);
-            check = 1;
-        }
-    }
-}
-
-static void timer_task(void *arg)
-{
-    (void) arg;
-
-    gptimer_config_t timer_config;
-    gptimer_event_callbacks_t timer_callbacks;
-    gptimer_alarm_config_t alarm_config;
-
-    memset(&timer_config, 0, sizeof(timer_config));
-    memset(&timer_callbacks, 0, sizeof(timer_callbacks));
-    memset(&alarm_config, 0, sizeof(alarm_config));
-
-    timer_config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
-    timer_config.direction = GPTIMER_COUNT_UP;
-    timer_config.resolution_hz = 1000;
-    timer_callbacks.on_alarm = timer_handler;
-    alarm_config.alarm_count = RESET_TIMEOUT;
-
-    gptimer_new_timer(&timer_config, &timer);
-    gptimer_register_event_callbacks(timer, &timer_callbacks, NULL);
-    gptimer_set_alarm_action(timer, &alarm_config);
-    gptimer_enable(timer);
-
-    vTaskSuspend(NULL);
-    reset_update_count(0);
-    reset_to_factory();
-}
-
-static void reset_task(void *arg)
-{
-    (void) arg;
-
     if (count >= RESET_COUNT)
     {
         ESP_LOGW(tag, "Pending");
@@ -105,58 +70,22 @@ static void reset_task(void *arg)
     }
 
     reset_update_count(count);
-    vTaskDelay(pdMS_TO_TICKS(RESET_TIMEOUT));
-
-    if (!reset_flag)
-    {
-        reset_update_count(0);
-        vTaskDelete(NULL);
-    }
-
-    reset_to_factory();
-    vTaskDelete(NULL);
-}
-
-void reset_init(void)
-{
-    nvs_handle_t handle;
-
-    nvs_flash_init_partition("nvs");
-    nvs_open_from_partition("nvs", "nvs", NVS_READONLY, &handle);
-
-    if (nvs_get_u8(handle, "reset_count", &count) != ESP_OK)
-        count = 0;
-
-    nvs_close(handle);
-    count++;
-
-    xTaskCreate(button_task, "button", 4096, NULL, 0, &button_handle);
-    xTaskCreate(timer_task,  "timer",  4096, NULL, 0, &timer_handle);
-    xTaskCreate(reset_task,  "reset",  4096, NULL, 0, NULL);
+    scheduler_delay(&reset_job, RESET_TIMEOUT);
 }
 
 void reset_update_count(uint8_t count)
 {
-    nvs_handle_t handle;
-    uint8_t check = 0;
-
-    nvs_flash_init_partition("nvs");
-    nvs_open_from_partition("nvs", "nvs", NVS_READWRITE, &handle);
-    nvs_get_u8(handle, "reset_count", &check);
-
-    if (check != count)
-    {
-        ESP_LOGI(tag, "Count is %d", count);
-        nvs_set_u8(handle, "reset_count", count);
-        nvs_commit(handle);
-    }
+    if (settings_get(SETTING_RESET_COUNT) == count)
+        return;
 
-    nvs_close(handle);
+    ESP_LOGI(tag, "Count is %d", count);
+    settings_set(SETTING_RESET_COUNT, count);
+    settings_flush();
 }
 
 void reset_to_factory(void)
 {
-    nvs_flash_erase_partition("nvs");
+    settings_erase();
     esp_zb_factory_reset();
 }
 
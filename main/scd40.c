@@ -1,128 +1,295 @@
 #include <string.h>
-#include "driver/i2c.h"
+#include "driver/i2c_master.h"
 #include "esp_log.h"
-#include "esp_zigbee_core.h"
 #include "config.h"
-#include "led.h"
+#include "crc.h"
+#include "measurement.h"
 #include "scd40.h"
+#include "scheduler.h"
+#include "settings.h"
 #include "zigbee.h"
 
+#define STATE_WAKE_UP           0x00
+#define STATE_STOP              0x01
+#define STATE_REINIT            0x02
+#define STATE_SERIAL            0x03
+#define STATE_IDENTIFY          0x04
+#define STATE_VARIANT           0x05
+#define STATE_START             0x06
+#define STATE_POLL              0x07
+#define STATE_READY             0x08
+#define STATE_SHOT              0x09
+#define STATE_READ              0x0A
+
 static const char *tag = "scd40";
+static const char *mode_name[] = {"periodic", "low power periodic", "single shot"};
+static const uint32_t mode_interval[] = {SCD40_INTERVAL, 30000, SCD40_SHOT_INTERVAL};
+static const float mode_current[] = {15.0, 3.2, 0.45 * 300000 / SCD40_SHOT_INTERVAL};
+static struct scheduler_job step_job;
+static i2c_master_dev_handle_t device;
+static TickType_t ready_tick = 0, tick, check;
+static uint8_t mode, current, state, single_shot = 0;
 
-static uint8_t get_crc(const uint8_t *data)
+static bool parse_data(const uint8_t *buffer, uint16_t *data, uint8_t count)
 {
-    uint8_t crc = 0xFF;
+    uint8_t check = 0;
 
-    for (uint8_t i = 0; i < 2; i++)
+    for (uint8_t i = 0; i < count; i++, buffer += 3)
     {
-        crc ^= data[i];
-
-        for (uint8_t j = 0; j < 8; j++)
-            crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+        check |= buffer[2] ^ crc8(buffer, 2);
+        data[i] = buffer[0] << 8 | buffer[1];
     }
 
-    return crc;
+    return !check;
 }
 
-static void send_command(uint16_t command, uint16_t delay)
+static void send_command(uint16_t command)
 {
-    i2c_cmd_handle_t link = i2c_cmd_link_create();
-
-	i2c_master_start(link);
-	i2c_master_write_byte(link, (SCD40_ADDRESS << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(link, command >> 8, true);
-    i2c_master_write_byte(link, command, true);
-	i2c_master_stop(link);
-
-    i2c_master_cmd_begin(I2C_PORT, link, 1000);
-	i2c_cmd_link_delete(link);
-
-    vTaskDelay(pdMS_TO_TICKS(delay));
+    uint8_t data[2] = {command >> 8, command & 0xFF};
+    i2c_master_transmit(device, data, sizeof(data), 100);
 }
 
 static bool read_data(uint16_t *data, uint8_t count)
 {
-    i2c_cmd_handle_t link = i2c_cmd_link_create();
     uint8_t buffer[count * 3];
 
-    i2c_master_start(link);
-    i2c_master_write_byte(link, (SCD40_ADDRESS << 1) | I2C_MASTER_READ, true);
-    i2c_master_read(link, buffer, sizeof(buffer), I2C_MASTER_LAST_NACK);
-    i2c_master_stop(link);
+    if (i2c_master_receive(device, buffer, sizeof(buffer), 100) != ESP_OK)
+        return false;
 
-    i2c_master_cmd_begin(I2C_PORT, link, 1000);
-    i2c_cmd_link_delete(link);
+    return parse_data(buffer, data, count);
+}
+
+static void set_state(uint8_t value, uint32_t delay)
+{
+    state = value;
+    scheduler_delay(&step_job, delay);
+}
 
-    for (uint8_t i = 0; i < count; i++)
+static void read_measurement(void)
+{
+    uint16_t buffer[3];
+
+    if (read_data(buffer, 3))
     {
-        uint8_t *item = buffer + i * 3;
+        int16_t temperature = (int32_t) buffer[1] * 17500 / 65535 - 4500;
+        uint16_t humidity = (uint32_t) buffer[2] * 10000 / 65535;
 
-        if (item[2] != get_crc(item))
-            return false;
+        ready_tick = check;
+        ESP_LOGI(tag, "CO2 is %d ppm, temperature is %.2f °C, humidity is %.2f %%, sample age is %ld ms", buffer[0], temperature / 100.0, humidity / 100.0, scd40_sample_age());
 
-        data[i] = item[0] << 8 | item[1];
+        measurement_publish(MEASUREMENT_TEMPERATURE, temperature);
+        measurement_publish(MEASUREMENT_HUMIDITY, humidity);
+        measurement_publish(MEASUREMENT_CO2, buffer[0]);
+        return;
     }
 
-    return true;
+    ESP_LOGE(tag, "Data request failed");
 }
 
-static void scd40_task(void *arg)
+static void start_measurement(void)
 {
-    (void) arg;
+    current = mode;
+
+    switch (current)
+    {
+        case SCD40_MODE_PERIODIC:  send_command(SCD40_START_PERIODIC_MEASUREMENT); break;
+        case SCD40_MODE_LOW_POWER: send_command(SCD40_START_LOW_POWER_PERIODIC_MEASUREMENT); break;
+        default: break;
+    }
 
-    i2c_config_t config;
-    TickType_t tick;
+    ESP_LOGI(tag, "Mode is %s, estimated sensor current is %.2f mA", mode_name[current], mode_current[current]);
+
+    tick = check = xTaskGetTickCount();
+    set_state(STATE_POLL, 1);
+}
+
+static void step_callback(void)
+{
     uint16_t buffer[3];
 
-    memset(&config, 0, sizeof(config));
+    switch (state)
+    {
+        case STATE_WAKE_UP:
+            send_command(SCD40_WAKE_UP);
+            set_state(STATE_STOP, 20);
+            break;
 
-    config.mode = I2C_MODE_MASTER;
-    config.sda_io_num = I2C_SDA_PIN;
-    config.scl_io_num = 3; //I2C_SCL_PIN;
-    config.master.clk_speed = 100000;
+        case STATE_STOP:
+            send_command(SCD40_STOP_PERIODIC_MEASUREMENT);
+            set_state(STATE_REINIT, 500);
+            break;
 
-    i2c_driver_install(I2C_PORT, config.mode, 0, 0, 0);
-    i2c_param_config(I2C_PORT, &config);
+        case STATE_REINIT:
+            send_command(SCD40_REINIT);
+            set_state(STATE_SERIAL, 20);
+            break;
 
-    send_command(SCD40_WAKE_UP, 20);
-    send_command(SCD40_STOP_PERIODIC_MEASUREMENT, 500);
-    send_command(SCD40_REINIT, 20);
-    send_command(SCD40_GET_SERIAL_NUMBER, 1);
+        case STATE_SERIAL:
+            send_command(SCD40_GET_SERIAL_NUMBER);
+            set_state(STATE_IDENTIFY, 1);
+            break;
 
-    if (read_data(buffer, 3))
-    {
-        ESP_LOGI(tag, "Serial number is %04X%04X%04X", buffer[0], buffer[1], buffer[2]);
-    }
-    else
-    {
-        ESP_LOGE(tag, "Serial number request failed");
-    }
+        case STATE_IDENTIFY:
 
-    send_command(SCD40_START_PERIODIC_MEASUREMENT, 1);
-    tick = xTaskGetTickCount();
+            if (read_data(buffer, 3))
+            {
+                ESP_LOGI(tag, "Serial number is %04X%04X%04X", buffer[0], buffer[1], buffer[2]);
+            }
+            else
+            {
+                ESP_LOGE(tag, "Serial number request failed");
+            }
 
-    while (true)
-    {
-        vTaskDelayUntil(&tick, pdMS_TO_TICKS(5000));
-        send_command(SCD40_READ_MEASUREMENT, 1);
+            send_command(SCD40_GET_SENSOR_VARIANT);
+            set_state(STATE_VARIANT, 1);
+            break;
+
+        case STATE_VARIANT:
+
+            single_shot = read_data(buffer, 1) && buffer[0] >> 12;
+            ESP_LOGI(tag, "Single shot mode is %s", single_shot ? "supported" : "not supported");
+
+            if (mode == SCD40_MODE_SINGLE_SHOT && !single_shot)
+            {
+                mode = SCD40_MODE_PERIODIC;
+                settings_set(SETTING_SCD40_MODE, mode);
+                zigbee_update_scd40_mode();
+            }
+
+            start_measurement();
+            break;
+
+        case STATE_START:
+            start_measurement();
+            break;
+
+        case STATE_POLL:
 
-        if (read_data(buffer, 3))
-        {
-            float value = buffer[0] / 1e6;
+            if (current != mode)
+            {
+                if (current == SCD40_MODE_SINGLE_SHOT)
+                {
+                    start_measurement();
+                    break;
+                }
 
-            if (!zigbee_steering())
-                esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CARBON_DIOXIDE_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_CARBON_DIOXIDE_MEASUREMENT_MEASURED_VALUE_ID, &value, false);
+                send_command(SCD40_STOP_PERIODIC_MEASUREMENT);
+                set_state(STATE_START, 500);
+                break;
+            }
 
-            ESP_LOGI(tag, "CO2 is %d ppm", buffer[0]);
-            led_set_co2(buffer[0]);
-            continue;
-        }
+            if (current == SCD40_MODE_SINGLE_SHOT)
+            {
+                send_command(SCD40_MEASURE_SINGLE_SHOT);
+                set_state(STATE_SHOT, 5000);
+                break;
+            }
 
-        ESP_LOGE(tag, "Data request failed");
+            send_command(SCD40_GET_DATA_READY_STATUS);
+            set_state(STATE_READY, 1);
+            break;
+
+        case STATE_READY:
+
+            if (!read_data(buffer, 1) || !(buffer[0] & 0x07FF))
+            {
+                check = xTaskGetTickCount();
+
+                if (check - tick > pdMS_TO_TICKS(2 * mode_interval[current]))
+                {
+                    ESP_LOGE(tag, "Data ready timeout");
+                    tick = check;
+                }
+
+                set_state(STATE_POLL, SCD40_POLL_INTERVAL);
+                break;
+            }
+
+            send_command(SCD40_READ_MEASUREMENT);
+            set_state(STATE_READ, 1);
+            break;
+
+        case STATE_SHOT:
+            check = xTaskGetTickCount();
+            send_command(SCD40_READ_MEASUREMENT);
+            set_state(STATE_READ, 1);
+            break;
+
+        case STATE_READ:
+            read_measurement();
+
+            if (current == SCD40_MODE_SINGLE_SHOT)
+            {
+                set_state(STATE_POLL, mode_interval[current] - 5000);
+                break;
+            }
+
+            tick = xTaskGetTickCount();
+            set_state(STATE_POLL, mode_interval[current] - 4 * SCD40_POLL_INTERVAL);
+            check = tick;
+            break;
     }
 }
 
 void scd40_init(void)
 {
-    xTaskCreate(scd40_task, "scd40", 4096, NULL, 0, NULL);
+    i2c_master_bus_config_t bus_config;
+    i2c_device_config_t device_config;
+    i2c_master_bus_handle_t bus;
+
+    if ((mode = settings_get(SETTING_SCD40_MODE)) > SCD40_MODE_SINGLE_SHOT)
+        mode = SCD40_MODE_PERIODIC;
+
+    memset(&bus_config, 0, sizeof(bus_config));
+    memset(&device_config, 0, sizeof(device_config));
+
+    bus_config.i2c_port = I2C_PORT;
+    bus_config.sda_io_num = I2C_SDA_PIN;
+    bus_config.scl_io_num = I2C_SCL_PIN;
+    bus_config.clk_source = I2C_CLK_SRC_DEFAULT;
+    bus_config.glitch_ignore_cnt = 7;
+
+    device_config.dev_addr_length = I2C_ADDR_BIT_LEN_7;
+    device_config.device_address = SCD40_ADDRESS;
+    device_config.scl_speed_hz = I2C_FREQUENCY;
+
+    i2c_new_master_bus(&bus_config, &bus);
+    i2c_master_bus_add_device(bus, &device_config, &device);
+
+    scheduler_init_job(&step_job, step_callback, "scd40");
+    set_state(STATE_WAKE_UP, 0);
+}
+
+bool scd40_set_mode(uint8_t value)
+{
+    if (value > SCD40_MODE_SINGLE_SHOT || (value == SCD40_MODE_SINGLE_SHOT && !single_shot))
+    {
+        ESP_LOGW(tag, "Mode 0x%02x is not supported", value);
+        return false;
+    }
+
+    if (mode != value)
+    {
+        mode = value;
+        settings_set(SETTING_SCD40_MODE, mode);
+    }
+    else if (mode != SCD40_MODE_SINGLE_SHOT)
+    {
+        return true;
+    }
+
+    if (state == STATE_POLL)
+        scheduler_delay(&step_job, 0);
+
+    return true;
+}
+
+uint8_t scd40_mode(void)
+{
+    return mode;
+}
+
+uint32_t scd40_sample_age(void)
+{
+    return pdTICKS_TO_MS(xTaskGetTickCount() - ready_tick);
 }
@@ -1,16 +1,30 @@
 #ifndef SCD40_H
 #define SCD40_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #define SCD40_ADDRESS                       0x62
 
 #define SCD40_WAKE_UP                       0x36F6
 #define SCD40_REINIT                        0x3646
 #define SCD40_GET_SERIAL_NUMBER             0x3682
+#define SCD40_GET_SENSOR_VARIANT            0x202F
 #define SCD40_STOP_PERIODIC_MEASUREMENT     0x3F86
 #define SCD40_START_PERIODIC_MEASUREMENT    0x21B1
+#define SCD40_START_LOW_POWER_PERIODIC_MEASUREMENT  0x21AC
+#define SCD40_MEASURE_SINGLE_SHOT           0x219D
 #define SCD40_READ_MEASUREMENT              0xEC05
+#define SCD40_GET_DATA_READY_STATUS         0xE4B8
 #define SCD40_PERFORM_FORCED_RECALIBRATION  0x362F
 
-void scd40_init(void);
+#define SCD40_MODE_PERIODIC                 0x00
+#define SCD40_MODE_LOW_POWER                0x01
+#define SCD40_MODE_SINGLE_SHOT              0x02
+
+void     scd40_init(void);
+bool     scd40_set_mode(uint8_t value);
+uint8_t  scd40_mode(void);
+uint32_t scd40_sample_age(void);
 
 #endif
@@ -0,0 +1,196 @@
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "config.h"
+#include "scheduler.h"
+
+static const char *tag = "scheduler";
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t queue;
+static TaskHandle_t task_handle = NULL;
+static struct scheduler_job *timers = NULL;
+static uint32_t wakeups = 0;
+
+static void unlink_job(struct scheduler_job *job)
+{
+    struct scheduler_job **link = &timers;
+
+    if (!job->armed)
+        return;
+
+    while (*link != job)
+        link = &(*link)->next;
+
+    *link = job->next;
+    job->armed = 0;
+}
+
+static bool insert_job(struct scheduler_job *job, TickType_t deadline)
+{
+    struct scheduler_job **link = &timers;
+
+    unlink_job(job);
+
+    while (*link && (int32_t) ((*link)->deadline - deadline) <= 0)
+        link = &(*link)->next;
+
+    job->deadline = deadline;
+    job->next = *link;
+    job->armed = 1;
+    *link = job;
+
+    return timers == job;
+}
+
+static void wake_task(void)
+{
+    struct scheduler_job *job = NULL;
+
+    if (xTaskGetCurrentTaskHandle() != task_handle)
+        xQueueSend(queue, &job, 0);
+}
+
+static TickType_t get_timeout(void)
+{
+    TickType_t timeout = portMAX_DELAY, now = xTaskGetTickCount();
+
+    taskENTER_CRITICAL(&lock);
+
+    if (timers)
+        timeout = (int32_t) (timers->deadline - now) > 0 ? timers->deadline - now : 0;
+
+    taskEXIT_CRITICAL(&lock);
+    return timeout;
+}
+
+static struct scheduler_job *get_expired(void)
+{
+    struct scheduler_job *job = NULL;
+
+    taskENTER_CRITICAL(&lock);
+
+    if (timers && (int32_t) (xTaskGetTickCount() - timers->deadline) >= 0)
+    {
+        job = timers;
+        unlink_job(job);
+    }
+
+    taskEXIT_CRITICAL(&lock);
+    return job;
+}
+
+static void run_job(struct scheduler_job *job)
+{
+    TickType_t start = xTaskGetTickCount(), elapsed;
+
+    job->callback();
+
+    if ((elapsed = pdTICKS_TO_MS(xTaskGetTickCount() - start)) > SCHEDULER_SLOW_JOB)
+        ESP_LOGW(tag, "Job %s took %ld ms", job->name, elapsed);
+}
+
+static void scheduler_task(void *arg)
+{
+    (void) arg;
+
+    while (true)
+    {
+        struct scheduler_job *job;
+        BaseType_t received = xQueueReceive(queue, &job, get_timeout());
+
+        wakeups++;
+
+        if (received && job)
+        {
+            atomic_store(&job->queued, false);
+            run_job(job);
+        }
+
+        while ((job = get_expired()))
+            run_job(job);
+    }
+}
+
+void scheduler_init(void)
+{
+    queue = xQueueCreate(SCHEDULER_QUEUE_LENGTH, sizeof(struct scheduler_job*));
+    xTaskCreate(scheduler_task, "scheduler", 4096, NULL, 0, &task_handle);
+}
+
+void scheduler_init_job(struct scheduler_job *job, void (*callback)(void), const char *name)
+{
+    job->callback = callback;
+    job->name = name;
+    job->next = NULL;
+    job->armed = 0;
+    atomic_init(&job->queued, false);
+}
+
+void scheduler_delay(struct scheduler_job *job, uint32_t delay)
+{
+    bool head;
+
+    taskENTER_CRITICAL(&lock);
+    head = insert_job(job, xTaskGetTickCount() + pdMS_TO_TICKS(delay));
+    taskEXIT_CRITICAL(&lock);
+
+    if (head)
+        wake_task();
+}
+
+void scheduler_repeat(struct scheduler_job *job, uint32_t interval)
+{
+    TickType_t now = xTaskGetTickCount(), deadline;
+    bool head = false;
+
+    taskENTER_CRITICAL(&lock);
+    deadline = job->deadline + pdMS_TO_TICKS(interval);
+
+    if (!job->armed)
+        head = insert_job(job, (int32_t) (deadline - now) > 0 ? deadline : now + pdMS_TO_TICKS(interval));
+
+    taskEXIT_CRITICAL(&lock);
+
+    if (head)
+        wake_task();
+}
+
+void scheduler_cancel(struct scheduler_job *job)
+{
+    taskENTER_CRITICAL(&lock);
+    unlink_job(job);
+    taskEXIT_CRITICAL(&lock);
+}
+
+void scheduler_post(struct scheduler_job *job)
+{
+    if (!job->callback || atomic_exchange(&job->queued, true))
+        return;
+
+    if (!xQueueSend(queue, &job, 0))
+    {
+        ESP_LOGE(tag, "Queue is full, job %s dropped", job->name);
+        atomic_store(&job->queued, false);
+    }
+}
+
+void IRAM_ATTR scheduler_post_from_isr(struct scheduler_job *job)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (!job->callback || atomic_exchange(&job->queued, true))
+        return;
+
+    if (!xQueueSendFromISR(queue, &job, &woken))
+        atomic_store(&job->queued, false);
+
+    if (woken)
+        portYIELD_FROM_ISR();
+}
+
+uint32_t scheduler_wakeups(void)
+{
+    return wakeups;
+}
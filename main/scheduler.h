@@ -0,0 +1,28 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+struct scheduler_job
+{
+    void        (*callback)(void);
+    const char  *name;
+    struct scheduler_job *next;
+    TickType_t  deadline;
+    uint8_t     armed;
+    atomic_bool queued;
+};
+
+void     scheduler_init(void);
+void     scheduler_init_job(struct scheduler_job *job, void (*callback)(void), const char *name);
+void     scheduler_delay(struct scheduler_job *job, uint32_t delay);
+void     scheduler_repeat(struct scheduler_job *job, uint32_t interval);
+void     scheduler_cancel(struct scheduler_job *job);
+void     scheduler_post(struct scheduler_job *job);
+void     scheduler_post_from_isr(struct scheduler_job *job);
+uint32_t scheduler_wakeups(void);
+
+#endif
@@ -0,0 +1,150 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "nvs_flash.h"
+#include "config.h"
+#include "scd40.h"
+#include "settings.h"
+
+struct setting
+{
+    const char *key;
+    uint8_t     value;
+};
+
+static const char *tag = "settings";
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t timer;
+static nvs_handle_t handle;
+static uint32_t dirty = 0, changes = 0, commits = 0;
+static uint8_t opened = 0;
+
+static struct setting settings[SETTINGS_COUNT] =
+{
+    {"led_enabled",    1},
+    {"led_brightness", LED_DEFAULT_LEVEL},
+    {"fan_mode",       3},
+    {"reset_count",    0},
+    {"scd40_mode",     SCD40_MODE_PERIODIC}
+};
+
+static void timer_callback(void *arg)
+{
+    (void) arg;
+    settings_flush();
+}
+
+void settings_init(void)
+{
+    esp_timer_create_args_t timer_args;
+
+    memset(&timer_args, 0, sizeof(timer_args));
+
+    timer_args.callback = timer_callback;
+    timer_args.name = "settings";
+
+    if (nvs_open_from_partition("nvs", "nvs", NVS_READWRITE, &handle) != ESP_OK)
+    {
+        ESP_LOGE(tag, "NVS open failed");
+        return;
+    }
+
+    for (uint8_t i = 0; i < SETTINGS_COUNT; i++)
+        nvs_get_u8(handle, settings[i].key, &settings[i].value);
+
+    esp_timer_create(&timer_args, &timer);
+    esp_register_shutdown_handler(settings_flush);
+    opened = 1;
+}
+
+uint8_t settings_get(uint8_t id)
+{
+    return settings[id].value;
+}
+
+void settings_set(uint8_t id, uint8_t value)
+{
+    taskENTER_CRITICAL(&lock);
+
+    if (settings[id].value == value)
+    {
+        taskEXIT_CRITICAL(&lock);
+        return;
+    }
+
+    settings[id].value = value;
+    dirty |= 1 << id;
+    changes++;
+
+    taskEXIT_CRITICAL(&lock);
+
+    if (!opened)
+        return;
+
+    esp_timer_stop(timer);
+    esp_timer_start_once(timer, SETTINGS_DEBOUNCE * 1000ULL);
+}
+
+void settings_flush(void)
+{
+    uint8_t values[SETTINGS_COUNT];
+    uint32_t mask;
+
+    if (!opened)
+        return;
+
+    taskENTER_CRITICAL(&lock);
+
+    mask = dirty;
+    dirty = 0;
+
+    for (uint8_t i = 0; i < SETTINGS_COUNT; i++)
+        values[i] = settings[i].value;
+
+    taskEXIT_CRITICAL(&lock);
+
+    if (!mask)
+        return;
+
+    for (uint8_t i = 0; i < SETTINGS_COUNT; i++)
+        if (mask & 1 << i)
+            nvs_set_u8(handle, settings[i].key, values[i]);
+
+    nvs_commit(handle);
+    commits++;
+
+    ESP_LOGI(tag, "Saved, %ld commits avoided", changes - commits);
+}
+
+uint8_t settings_get_blob(const char *key, void *data, size_t size)
+{
+    size_t length = size;
+    return opened && nvs_get_blob(handle, key, data, &length) == ESP_OK && length == size;
+}
+
+void settings_set_blob(const char *key, const void *data, size_t size)
+{
+    if (!opened)
+        return;
+
+    if (data)
+        nvs_set_blob(handle, key, data, size);
+    else
+        nvs_erase_key(handle, key);
+
+    nvs_commit(handle);
+}
+
+void settings_erase(void)
+{
+    if (opened)
+    {
+        esp_timer_stop(timer);
+        nvs_close(handle);
+        opened = 0;
+    }
+
+    nvs_flash_erase_partition("nvs");
+}
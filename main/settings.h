@@ -0,0 +1,22 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SETTING_LED_ENABLED     0x00
+#define SETTING_LED_BRIGHTNESS  0x01
+#define SETTING_FAN_MODE        0x02
+#define SETTING_RESET_COUNT     0x03
+#define SETTING_SCD40_MODE      0x04
+#define SETTINGS_COUNT          5
+
+void    settings_init(void);
+uint8_t settings_get(uint8_t id);
+void    settings_set(uint8_t id, uint8_t value);
+void    settings_flush(void);
+void    settings_erase(void);
+uint8_t settings_get_blob(const char *key, void *data, size_t size);
+void    settings_set_blob(const char *key, const void *data, size_t size);
+
+#endif
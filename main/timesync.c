@@ -0,0 +1,136 @@
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "config.h"
+#include "scheduler.h"
+#include "timesync.h"
+#include "zigbee.h"
+
+#define MAX_DRIFT               500
+#define DRIFT_WINDOW            21600000
+
+struct timesync_state
+{
+    int64_t  base_time;
+    int64_t  base_wall;
+    int64_t  anchor_time;
+    uint32_t anchor_wall;
+    int32_t  drift;
+    uint32_t interval;
+    uint32_t retry;
+    uint8_t  valid;
+};
+
+static const char *tag = "timesync";
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static struct scheduler_job sync_job;
+static struct timesync_state state;
+
+static int64_t estimate(int64_t time)
+{
+    int64_t elapsed = time - state.base_time;
+    return state.base_wall + elapsed + elapsed * state.drift / 1000000;
+}
+
+static void sync_callback(void)
+{
+    int64_t time = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&lock);
+    state.base_wall = estimate(time);
+    state.base_time = time;
+    taskEXIT_CRITICAL(&lock);
+
+    zigbee_read_time();
+    scheduler_delay(&sync_job, state.retry);
+
+    if (state.retry < state.interval)
+        state.retry = state.retry * 2 < state.interval ? state.retry * 2 : state.interval;
+}
+
+void timesync_init(void)
+{
+    state.interval = TIME_MIN_INTERVAL;
+    state.retry = TIME_RETRY_INTERVAL;
+    scheduler_init_job(&sync_job, sync_callback, "timesync");
+}
+
+void timesync_start(void)
+{
+    state.retry = TIME_RETRY_INTERVAL;
+    scheduler_post(&sync_job);
+}
+
+void timesync_update(uint32_t time)
+{
+    struct timeval tv;
+    int64_t now = esp_timer_get_time(), elapsed = now - state.anchor_time;
+    int32_t error = 0, drift = state.drift;
+
+    if (!state.valid)
+    {
+        state.anchor_time = now;
+        state.anchor_wall = time;
+    }
+    else
+    {
+        error = (int32_t) (time - estimate(now) / 1000000);
+
+        if (elapsed >= (int64_t) DRIFT_WINDOW * 1000)
+        {
+            drift = (int32_t) (((int64_t) (time - state.anchor_wall) * 1000000 - elapsed) * 1000000 / elapsed);
+
+            if (drift > MAX_DRIFT)
+                drift = MAX_DRIFT;
+            else if (drift < -MAX_DRIFT)
+                drift = -MAX_DRIFT;
+        }
+
+        if (error > TIME_MAX_ERROR || error < -TIME_MAX_ERROR)
+            state.interval = state.interval / 2 > TIME_MIN_INTERVAL ? state.interval / 2 : TIME_MIN_INTERVAL;
+        else
+            state.interval = state.interval * 2 < TIME_MAX_INTERVAL ? state.interval * 2 : TIME_MAX_INTERVAL;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    state.base_time = now;
+    state.base_wall = (int64_t) time * 1000000;
+    state.drift = drift;
+    state.valid = 1;
+    taskEXIT_CRITICAL(&lock);
+
+    tv.tv_sec = time;
+    tv.tv_usec = 0;
+    settimeofday(&tv, NULL);
+
+    ESP_LOGI(tag, "Server timestamp is %ld, error is %ld s, drift is %ld ppm, next sync in %ld s", time, error, drift, state.interval / 1000);
+
+    state.retry = TIME_RETRY_INTERVAL;
+    scheduler_delay(&sync_job, state.interval);
+}
+
+uint8_t timesync_valid(void)
+{
+    return state.valid;
+}
+
+uint32_t timesync_monotonic(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+uint32_t timesync_wall(uint32_t monotonic)
+{
+    int64_t time;
+
+    if (!state.valid)
+        return 0;
+
+    taskENTER_CRITICAL(&lock);
+    time = state.base_time + (int64_t) (int32_t) (monotonic - (uint32_t) (state.base_time / 1000)) * 1000;
+    time = estimate(time);
+    taskEXIT_CRITICAL(&lock);
+
+    return time / 1000000;
+}
@@ -0,0 +1,15 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <stdint.h>
+
+#define TIMESYNC_EPOCH          946684800
+
+void     timesync_init(void);
+void     timesync_start(void);
+void     timesync_update(uint32_t time);
+uint8_t  timesync_valid(void);
+uint32_t timesync_monotonic(void);
+uint32_t timesync_wall(uint32_t monotonic);
+
+#endif
@@ -1,20 +1,54 @@
 
+#include <stdatomic.h>
 #include <string.h>
-#include <sys/time.h>
 #include "esp_log.h"
-#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_zigbee_core.h"
 #include "config.h"
+#include "diagnostics.h"
 #include "fan.h"
+#include "history.h"
 #include "led.h"
+#include "measurement.h"
+#include "offline.h"
+#include "ota.h"
 #include "reset.h"
+#include "scd40.h"
+#include "scheduler.h"
+#include "timesync.h"
+
+#define UPDATE_DIAGNOSTICS      (1 << MEASUREMENT_COUNT)
+#define UPDATE_SCD40_MODE       (1 << (MEASUREMENT_COUNT + 1))
+#define UPDATE_RETRY            100
+
+struct update_stats
+{
+    uint32_t applied;
+    uint32_t coalesced;
+    uint32_t depth_max;
+    uint32_t latency_max;
+    uint32_t hold_max;
+    uint32_t first_report;
+};
 
 static const char *tag = "zigbee";
-static const esp_partition_t *ota_partition = NULL;
-static esp_ota_handle_t ota_handle = 0;
-static uint32_t ota_size = 0, ota_offset = 0;
-static uint8_t steering_flag = 1;
+static uint8_t steering_flag = 1, connected = 0, delivered = 0, rejoin_count = 0, link_failures = 0, probe_pending = 0, probe_tsn, report_pending = 0, report_tsn, summary_pending = 0, summary_tsn;
+static int64_t rejoin_start = 0;
 static struct basic_data basic;
+static struct update_stats update_stats;
+static struct scheduler_job arm_job;
+static atomic_uint pending_mask, queued_time;
+
+static const uint16_t report_cluster[MEASUREMENT_COUNT] =
+{
+    ESP_ZB_ZCL_CLUSTER_ID_CARBON_DIOXIDE_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_ID_PM2_5_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT
+};
+
+static const uint16_t report_attribute[MEASUREMENT_COUNT] =
+{
+    ESP_ZB_ZCL_ATTR_CARBON_DIOXIDE_MEASUREMENT_MEASURED_VALUE_ID, ESP_ZB_ZCL_ATTR_PM2_5_MEASUREMENT_MEASURED_VALUE_ID, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, ESP_ZB_ZCL_ATTR_REL_HUMIDITY_MEASUREMENT_VALUE_ID
+};
 
 static void set_zcl_string(char *buffer, char *value)
 {
@@ -22,6 +56,29 @@ static void set_zcl_string(char *buffer, char *value)
     memcpy(buffer + 1, value, buffer[0]);
 }
 
+static void set_reporting(uint16_t cluster_id, uint16_t attr_id, uint16_t min_interval, uint16_t max_interval, const void *delta, size_t size)
+{
+    esp_zb_zcl_reporting_info_t info;
+
+    memset(&info, 0, sizeof(info));
+
+    info.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV;
+    info.ep = DEFAULT_ENDPOINT;
+    info.cluster_id = cluster_id;
+    info.cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE;
+    info.attr_id = attr_id;
+    info.dst.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    info.manuf_code = ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC;
+
+    info.u.send_info.min_interval = min_interval;
+    info.u.send_info.max_interval = max_interval;
+    info.u.send_info.def_min_interval = min_interval;
+    info.u.send_info.def_max_interval = max_interval;
+
+    memcpy(&info.u.send_info.delta, delta, size);
+    esp_zb_zcl_update_reporting_info(&info);
+}
+
 static esp_err_t set_attribute_handler(esp_zb_zcl_set_attr_value_message_t *message)
 {
     if (message->info.dst_endpoint != DEFAULT_ENDPOINT || message->info.status != ESP_ZB_ZCL_STATUS_SUCCESS)
@@ -57,6 +114,15 @@ static esp_err_t set_attribute_handler(esp_zb_zcl_set_attr_value_message_t *mess
                 return ESP_OK;
             }
 
+            break;
+
+        case CUSTOM_CLUSTER:
+
+            if (message->attribute.id == SCD40_MODE_ATTRIBUTE && message->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM && message->attribute.data.value)
+            {
+                return scd40_set_mode(*(uint8_t*) message->attribute.data.value) ? ESP_OK : ESP_ERR_INVALID_ARG;
+            }
+
             break;
     }
 
@@ -75,9 +141,8 @@ static esp_err_t ota_handler(esp_zb_zcl_ota_upgrade_value_message_t *message)
         case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_START:
 
             ESP_LOGI(tag, "OTA upgrade started");
-            ota_partition = esp_ota_get_next_update_partition(NULL);
 
-            if ((result = esp_ota_begin(ota_partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle)) != ESP_OK)
+            if ((result = ota_start(message->ota_header.file_version, message->ota_header.image_size)) != ESP_OK)
                 ESP_LOGE(tag, "OTA uprage begin failed, status: %s", esp_err_to_name(result));
 
             break;
@@ -88,31 +153,27 @@ static esp_err_t ota_handler(esp_zb_zcl_ota_upgrade_value_message_t *message)
 
         case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_RECEIVE:
 
-            ota_size = message->ota_header.image_size;
-            ota_offset += message->payload_size;
-
-            ESP_LOGI(tag, "OTA upgrade received %06ld/%ld bytes", ota_offset, ota_size);
-
-            if (message->payload_size && message->payload && (result = esp_ota_write(ota_handle, (const void*) message->payload, message->payload_size)) != ESP_OK)
+            if (message->payload_size && message->payload && (result = ota_write(message->payload, message->payload_size)) != ESP_OK)
                 ESP_LOGE(tag, "OTA uprage write failed, status: %s", esp_err_to_name(result));
 
             break;
 
         case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_FINISH:
 
-            if ((result = esp_ota_end(ota_handle)) != ESP_OK)
-                ESP_LOGE(tag, "OTA uprage end failed, status: %s", esp_err_to_name(result));
-
-            if ((result = esp_ota_set_boot_partition(ota_partition)) != ESP_OK)
-                ESP_LOGE(tag, "OTA uprage set boot partition failed, status: %s", esp_err_to_name(result));
+            if ((result = ota_finish()) != ESP_OK)
+                ESP_LOGE(tag, "OTA uprage finish failed, status: %s", esp_err_to_name(result));
 
             ESP_LOGI(tag, "OTA uprage finished: version: 0x%lx, manufacturer code: 0x%x, image type: 0x%x, total size: %ld", message->ota_header.file_version, message->ota_header.manufacturer_code, message->ota_header.image_type, message->ota_header.image_size);
             esp_restart();
             break;
 
+        case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_ABORT:
+            ota_abort();
+            break;
+
         case ESP_ZB_ZCL_OTA_UPGRADE_STATUS_CHECK:
 
-            if (ota_offset != ota_size)
+            if (ota_check() != ESP_OK)
             {
                 ESP_LOGE(tag, "OTA uprage check failed");
                 return ESP_FAIL;
@@ -128,6 +189,58 @@ static esp_err_t ota_handler(esp_zb_zcl_ota_upgrade_value_message_t *message)
     return result;
 }
 
+static esp_err_t custom_request_handler(esp_zb_zcl_custom_cluster_command_message_t *message)
+{
+    esp_zb_zcl_custom_cluster_cmd_req_t request;
+    uint8_t payload[9 + HISTORY_CHUNK * HISTORY_RECORD_SIZE], *data = message->data.value, tier, count;
+    uint32_t start, timestamp;
+    uint16_t interval;
+
+    if (message->info.dst_endpoint != DEFAULT_ENDPOINT || message->info.status != ESP_ZB_ZCL_STATUS_SUCCESS)
+        return ESP_FAIL;
+
+    if (message->info.cluster == DIAGNOSTICS_CLUSTER && message->info.command.id == DIAGNOSTICS_LOG_REQUEST)
+    {
+        diagnostics_request_log();
+        return ESP_OK;
+    }
+
+    if (message->info.cluster != CUSTOM_CLUSTER || message->info.command.id != HISTORY_REQUEST || message->data.size < 6 || !data)
+        return ESP_FAIL;
+
+    tier = data[0];
+    start = data[1] | data[2] << 8 | data[3] << 16 | (uint32_t) data[4] << 24;
+    count = history_read(tier, start, data[5] < HISTORY_CHUNK ? data[5] : HISTORY_CHUNK, &timestamp, payload + 9);
+    interval = history_interval(tier);
+
+    payload[0] = 8 + count * HISTORY_RECORD_SIZE;
+    payload[1] = tier;
+    payload[2] = timestamp & 0xFF;
+    payload[3] = timestamp >> 8 & 0xFF;
+    payload[4] = timestamp >> 16 & 0xFF;
+    payload[5] = timestamp >> 24 & 0xFF;
+    payload[6] = interval & 0xFF;
+    payload[7] = interval >> 8;
+    payload[8] = count;
+
+    memset(&request, 0, sizeof(request));
+
+    request.zcl_basic_cmd.dst_addr_u.addr_short = message->info.src_address.u.short_addr;
+    request.zcl_basic_cmd.dst_endpoint = message->info.src_endpoint;
+    request.zcl_basic_cmd.src_endpoint = DEFAULT_ENDPOINT;
+    request.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    request.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    request.cluster_id = CUSTOM_CLUSTER;
+    request.custom_cmd_id = HISTORY_RESPONSE;
+    request.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI;
+    request.data.type = ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING;
+    request.data.size = payload[0] + 1;
+    request.data.value = payload;
+
+    esp_zb_zcl_custom_cluster_cmd_req(&request);
+    return ESP_OK;
+}
+
 static esp_err_t read_attribute_handler(esp_zb_zcl_cmd_read_attr_resp_message_t *message)
 {
     if (message->info.dst_endpoint != DEFAULT_ENDPOINT || message->info.status != ESP_ZB_ZCL_STATUS_SUCCESS)
@@ -135,14 +248,14 @@ static esp_err_t read_attribute_handler(esp_zb_zcl_cmd_read_attr_resp_message_t
 
     switch (message->info.cluster)
     {
+        case ESP_ZB_ZCL_CLUSTER_ID_BASIC:
+            return ESP_OK;
+
         case ESP_ZB_ZCL_CLUSTER_ID_TIME:
 
             if (message->variables->attribute.id == ESP_ZB_ZCL_ATTR_TIME_LOCAL_TIME_ID && message->variables->attribute.data.type == ESP_ZB_ZCL_ATTR_TYPE_U32 && message->variables->attribute.data.value)
             {
-                struct timeval tv;
-                tv.tv_sec = *(uint32_t*) message->variables->attribute.data.value + 946684800;
-                ESP_LOGI(tag, "Server timestamp is %lld", tv.tv_sec);
-                settimeofday(&tv, NULL);
+                timesync_update(*(uint32_t*) message->variables->attribute.data.value + TIMESYNC_EPOCH);
                 return ESP_OK;
             }
 
@@ -165,6 +278,9 @@ static esp_err_t action_handler(esp_zb_core_action_callback_id_t callback, const
         case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID:
             return read_attribute_handler((esp_zb_zcl_cmd_read_attr_resp_message_t*) message);
 
+        case ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID:
+            return custom_request_handler((esp_zb_zcl_custom_cluster_command_message_t*) message);
+
         case ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID:
             return ESP_OK;
 
@@ -174,26 +290,304 @@ static esp_err_t action_handler(esp_zb_core_action_callback_id_t callback, const
     }
 }
 
-static void time_task(void *arg)
+static void set_diagnostics(void)
 {
-    (void) arg;
+    struct diagnostics data;
+
+    diagnostics_read(&data);
+
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_FREE_HEAP,       &data.free_heap,       false);
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_MINIMUM_HEAP,    &data.minimum_heap,    false);
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_UPTIME,          &data.uptime,          false);
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_SCHEDULER_STACK, &data.scheduler_stack, false);
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_ZIGBEE_STACK,    &data.zigbee_stack,    false);
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_CPU_LOAD,        &data.cpu_load,        false);
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_LED_RENDERED,    &data.led_rendered,    false);
+    esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, DIAGNOSTICS_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, DIAGNOSTICS_LED_SKIPPED,     &data.led_skipped,     false);
+}
 
-    esp_zb_zcl_read_attr_cmd_t request;
-    uint16_t attribute_id = ESP_ZB_ZCL_ATTR_TIME_LOCAL_TIME_ID;
+static void send_report(uint8_t type)
+{
+    esp_zb_zcl_report_attr_cmd_t request;
+
+    memset(&request, 0, sizeof(request));
 
+    request.zcl_basic_cmd.dst_addr_u.addr_short = 0x0000;
     request.zcl_basic_cmd.dst_endpoint = 0x01;
     request.zcl_basic_cmd.src_endpoint = DEFAULT_ENDPOINT;
+    request.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    request.clusterID = report_cluster[type];
+    request.cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE;
+    request.attributeID = report_attribute[type];
+
+    report_tsn = esp_zb_zcl_report_attr_cmd_req(&request);
+    report_pending = 1;
+}
+
+static void apply_updates(uint8_t param)
+{
+    (void) param;
+
+    int64_t start = esp_timer_get_time();
+    uint32_t mask = atomic_exchange(&pending_mask, 0), latency = start / 1000 - atomic_load(&queued_time), depth = 0, hold;
+    uint8_t first = MEASUREMENT_COUNT;
+
+    if (!mask)
+        return;
+
+    if (latency > update_stats.latency_max)
+        update_stats.latency_max = latency;
+
+    for (uint8_t type = 0; type < MEASUREMENT_COUNT; type++)
+    {
+        struct measurement sample;
+        float value;
+        int16_t temperature;
+        uint16_t humidity;
+
+        if (!(mask & 1 << type) || !measurement_read(type, &sample))
+            continue;
+
+        switch (type)
+        {
+            case MEASUREMENT_CO2:
+                value = sample.value / 1e6;
+                esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_CARBON_DIOXIDE_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_CARBON_DIOXIDE_MEASUREMENT_MEASURED_VALUE_ID, &value, false);
+                break;
+
+            case MEASUREMENT_PM25:
+                value = sample.value;
+                esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_PM2_5_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_PM2_5_MEASUREMENT_MEASURED_VALUE_ID, &value, false);
+                break;
+
+            case MEASUREMENT_TEMPERATURE:
+                temperature = sample.value;
+                esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, &temperature, false);
+                break;
+
+            case MEASUREMENT_HUMIDITY:
+                humidity = sample.value;
+                esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_REL_HUMIDITY_MEASUREMENT_VALUE_ID, &humidity, false);
+                break;
+        }
+
+        if (first == MEASUREMENT_COUNT)
+            first = type;
+
+        depth++;
+    }
+
+    if (first < MEASUREMENT_COUNT && !update_stats.first_report && !report_pending)
+        send_report(first);
+
+    if (mask & UPDATE_DIAGNOSTICS)
+    {
+        set_diagnostics();
+        depth++;
+    }
+
+    if (mask & UPDATE_SCD40_MODE)
+    {
+        uint8_t value = scd40_mode();
+        esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, CUSTOM_CLUSTER, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, SCD40_MODE_ATTRIBUTE, &value, false);
+        depth++;
+    }
+
+    if (depth > update_stats.depth_max)
+        update_stats.depth_max = depth;
+
+    hold = esp_timer_get_time() - start;
+
+    if (hold > update_stats.hold_max)
+        update_stats.hold_max = hold;
+
+    update_stats.applied += depth;
+    ESP_LOGD(tag, "Applied %ld attribute updates in %ld us (%ld total, %ld coalesced), depth max is %ld, latency max is %ld ms", depth, hold, update_stats.applied, update_stats.coalesced, update_stats.depth_max, update_stats.latency_max);
+}
+
+static void arm_updates(void)
+{
+    if (!esp_zb_lock_acquire(0))
+    {
+        scheduler_delay(&arm_job, UPDATE_RETRY);
+        return;
+    }
+
+    esp_zb_scheduler_alarm(apply_updates, 0, 0);
+    esp_zb_lock_release();
+}
+
+static void queue_update(uint32_t bit)
+{
+    uint32_t mask;
+
+    if (steering_flag)
+        return;
+
+    mask = atomic_fetch_or(&pending_mask, bit);
+
+    if (mask & bit)
+        update_stats.coalesced++;
+
+    if (mask)
+        return;
+
+    atomic_store(&queued_time, (uint32_t) (esp_timer_get_time() / 1000));
+    arm_updates();
+}
+
+static void measurement_callback(uint8_t type)
+{
+    queue_update(1 << type);
+}
+
+static void start_commissioning(uint8_t mode)
+{
+    esp_zb_bdb_start_top_level_commissioning(mode);
+}
+
+static void probe_link(uint8_t param)
+{
+    (void) param;
+
+    esp_zb_zcl_read_attr_cmd_t request;
+    uint16_t attribute_id = ESP_ZB_ZCL_ATTR_BASIC_ZCL_VERSION_ID;
+
+    if (steering_flag)
+        return;
+
+    memset(&request, 0, sizeof(request));
+
     request.zcl_basic_cmd.dst_addr_u.addr_short = 0x0000;
+    request.zcl_basic_cmd.dst_endpoint = 0x01;
+    request.zcl_basic_cmd.src_endpoint = DEFAULT_ENDPOINT;
     request.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
-    request.clusterID = ESP_ZB_ZCL_CLUSTER_ID_TIME;
+    request.clusterID = ESP_ZB_ZCL_CLUSTER_ID_BASIC;
     request.attr_number = 1;
     request.attr_field = &attribute_id;
 
-    while (true)
+    probe_tsn = esp_zb_zcl_read_attr_cmd_req(&request);
+    probe_pending = 1;
+}
+
+static void check_link(uint8_t param)
+{
+    (void) param;
+
+    esp_zb_scheduler_alarm(check_link, 0, LINK_CHECK_INTERVAL);
+
+    if (connected && !delivered && !probe_pending)
+        probe_link(0);
+
+    delivered = 0;
+}
+
+static void set_joined(void)
+{
+    steering_flag = 0;
+    probe_link(0);
+    led_update();
+}
+
+static void set_connected(void)
+{
+    ESP_LOGI(tag, "Coordinator reached %lld ms after joining started", (esp_timer_get_time() - rejoin_start) / 1000);
+
+    connected = 1;
+    delivered = 1;
+    rejoin_count = 0;
+    link_failures = 0;
+
+    queue_update(((1 << MEASUREMENT_COUNT) - 1) | UPDATE_SCD40_MODE);
+
+    timesync_start();
+    offline_flush();
+    led_update();
+}
+
+static void set_disconnected(void)
+{
+    if (!connected)
+        return;
+
+    ESP_LOGW(tag, "Network connection lost, rejoining");
+    connected = 0;
+    rejoin_count = 0;
+    rejoin_start = esp_timer_get_time();
+    esp_zb_scheduler_alarm(start_commissioning, ESP_ZB_BDB_MODE_INITIALIZATION, REJOIN_DELAY);
+}
+
+static void rejoin_failed(uint8_t restored)
+{
+    uint32_t delay = REJOIN_DELAY << (rejoin_count < REJOIN_ATTEMPTS - 1 ? rejoin_count : REJOIN_ATTEMPTS - 1);
+
+    if (++rejoin_count >= REJOIN_ATTEMPTS && !restored)
+    {
+        ESP_LOGW(tag, "Rejoin failed %d times, scanning all channels", rejoin_count);
+        steering_flag = 1;
+        rejoin_count = 0;
+        esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
+        return;
+    }
+
+    ESP_LOGW(tag, "Rejoin attempt %d failed, retrying in %ld ms", rejoin_count, delay);
+    esp_zb_scheduler_alarm(start_commissioning, ESP_ZB_BDB_MODE_INITIALIZATION, delay);
+}
+
+static void send_status_handler(esp_zb_zcl_command_send_status_message_t message)
+{
+    uint8_t success = message.status == ESP_ZB_ZCL_STATUS_SUCCESS;
+
+    if (probe_pending && message.tsn == probe_tsn)
+    {
+        probe_pending = 0;
+
+        if (!success && !connected)
+        {
+            rejoin_failed(1);
+            return;
+        }
+    }
+
+    if (summary_pending && message.tsn == summary_tsn)
     {
-        esp_zb_zcl_read_attr_cmd_req(&request);
-        vTaskDelay(pdMS_TO_TICKS(12 * 3600 * 1000)); // TODO: read time twice a day?
+        summary_pending = 0;
+        offline_delivered(success);
     }
+
+    if (report_pending && message.tsn == report_tsn)
+    {
+        report_pending = 0;
+
+        if (success)
+        {
+            update_stats.first_report = esp_timer_get_time() / 1000;
+            ESP_LOGI(tag, "First report sent %ld ms after boot", update_stats.first_report);
+        }
+        else
+        {
+            ESP_LOGW(tag, "First report was not delivered, status: 0x%02x", message.status);
+        }
+    }
+
+    if (success)
+    {
+        link_failures = 0;
+        delivered = 1;
+
+        if (!connected && !steering_flag)
+            set_connected();
+
+        return;
+    }
+
+    if (!connected)
+        return;
+
+    if (++link_failures >= LINK_FAILURES)
+        set_disconnected();
+    else if (!probe_pending)
+        esp_zb_scheduler_alarm(probe_link, 0, REJOIN_DELAY);
 }
 
 static void zigbee_task(void *arg)
@@ -209,9 +603,17 @@ static void zigbee_task(void *arg)
     esp_zb_fan_control_cluster_cfg_t fan_config;
     esp_zb_carbon_dioxide_measurement_cluster_cfg_t co2_config;
     esp_zb_pm2_5_measurement_cluster_cfg_t pm25_config;
-    esp_zb_attribute_list_t *basic_cluster, *time_cluster, *ota_cluster, *on_off_cluster, *level_cluster, *fan_cluster, *co2_cluster, *pm25_cluster;
+    esp_zb_temperature_meas_cluster_cfg_t temperature_config;
+    esp_zb_humidity_meas_cluster_cfg_t humidity_config;
+    esp_zb_attribute_list_t *basic_cluster, *time_cluster, *ota_cluster, *on_off_cluster, *level_cluster, *fan_cluster, *co2_cluster, *pm25_cluster, *temperature_cluster, *humidity_cluster, *custom_cluster, *diagnostics_cluster;
     esp_zb_cluster_list_t *cluster_list = esp_zb_zcl_cluster_list_create();
     esp_zb_ep_list_t *endpoint_list = esp_zb_ep_list_create();
+    struct diagnostics diagnostics_data;
+    uint32_t ota_version, ota_offset = 0;
+    uint8_t scd40_mode_value = scd40_mode();
+    float co2_change = CO2_REPORT_CHANGE / 1e6, pm25_change = PM25_REPORT_CHANGE;
+    int16_t temperature_change = TEMP_REPORT_CHANGE;
+    uint16_t humidity_change = HUMIDITY_REPORT_CHANGE;
 
     memset(&platform_config, 0, sizeof(platform_config));
     memset(&zigbee_config, 0, sizeof(zigbee_config));
@@ -222,6 +624,9 @@ static void zigbee_task(void *arg)
     memset(&fan_config, 0, sizeof(fan_config));
     memset(&co2_config, 0, sizeof(co2_config));
     memset(&pm25_config, 0, sizeof(pm25_config));
+    memset(&temperature_config, 0, sizeof(temperature_config));
+    memset(&humidity_config, 0, sizeof(humidity_config));
+    memset(&diagnostics_data, 0, sizeof(diagnostics_data));
 
     platform_config.radio_config.radio_mode = RADIO_MODE_NATIVE;
     platform_config.host_config.host_connection_mode = HOST_CONNECTION_MODE_NONE;
@@ -232,17 +637,21 @@ static void zigbee_task(void *arg)
 
     ota_data.timer_query = ESP_ZB_ZCL_OTA_UPGRADE_QUERY_TIMER_COUNT_DEF;
     ota_data.hw_version = 0x0001;
-    ota_data.max_data_size = 0x40;
+    ota_data.max_data_size = OTA_MAX_DATA_SIZE;
 
     ota_config.ota_upgrade_manufacturer = OTA_MANUFACTURER;
     ota_config.ota_upgrade_image_type = OTA_IMAGE_TYPE;
-    ota_config.ota_upgrade_downloaded_file_ver = OTA_FILE_VERSION;
+    ota_config.ota_upgrade_downloaded_file_ver = ota_checkpoint(&ota_version, &ota_offset) ? ota_version : OTA_FILE_VERSION;
 
     on_off_config.on_off = led_enabled();
     level_config.current_level = led_brightness();
     fan_config.fan_mode = fan_mode();
     co2_config.max_measured_value = 0.002; // 2000 / 1e6
     pm25_config.max_measured_value = 1000;
+    temperature_config.min_value = -1000;
+    temperature_config.max_value = 6000;
+    humidity_config.min_value = 0;
+    humidity_config.max_value = 10000;
 
     basic_cluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_BASIC);
     time_cluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_TIME);
@@ -252,6 +661,10 @@ static void zigbee_task(void *arg)
     fan_cluster = esp_zb_fan_control_cluster_create(&fan_config);
     co2_cluster = esp_zb_carbon_dioxide_measurement_cluster_create(&co2_config);
     pm25_cluster = esp_zb_pm2_5_measurement_cluster_create(&pm25_config);
+    temperature_cluster = esp_zb_temperature_meas_cluster_create(&temperature_config);
+    humidity_cluster = esp_zb_humidity_meas_cluster_create(&humidity_config);
+    custom_cluster = esp_zb_zcl_attr_list_create(CUSTOM_CLUSTER);
+    diagnostics_cluster = esp_zb_zcl_attr_list_create(DIAGNOSTICS_CLUSTER);
 
     esp_zb_platform_config(&platform_config);
     esp_zb_init(&zigbee_config);
@@ -265,6 +678,17 @@ static void zigbee_task(void *arg)
 
     esp_zb_ota_cluster_add_attr(ota_cluster,     ESP_ZB_ZCL_ATTR_OTA_UPGRADE_CLIENT_DATA_ID,   &ota_data);
 
+    esp_zb_custom_cluster_add_custom_attr(custom_cluster, SCD40_MODE_ATTRIBUTE, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &scd40_mode_value);
+
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_FREE_HEAP,       ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &diagnostics_data.free_heap);
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_MINIMUM_HEAP,    ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &diagnostics_data.minimum_heap);
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_UPTIME,          ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,                                    &diagnostics_data.uptime);
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_SCHEDULER_STACK, ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,                                    &diagnostics_data.scheduler_stack);
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_ZIGBEE_STACK,    ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,                                    &diagnostics_data.zigbee_stack);
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_CPU_LOAD,        ESP_ZB_ZCL_ATTR_TYPE_U8,  ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,                                    &diagnostics_data.cpu_load);
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_LED_RENDERED,    ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,                                    &diagnostics_data.led_rendered);
+    esp_zb_custom_cluster_add_custom_attr(diagnostics_cluster, DIAGNOSTICS_LED_SKIPPED,     ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,                                    &diagnostics_data.led_skipped);
+
     esp_zb_cluster_list_add_basic_cluster(cluster_list, basic_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
     esp_zb_cluster_list_add_time_cluster(cluster_list, time_cluster, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE);
     esp_zb_cluster_list_add_ota_cluster(cluster_list, ota_cluster, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE);
@@ -273,14 +697,28 @@ static void zigbee_task(void *arg)
     esp_zb_cluster_list_add_fan_control_cluster(cluster_list, fan_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
     esp_zb_cluster_list_add_carbon_dioxide_measurement_cluster(cluster_list, co2_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
     esp_zb_cluster_list_add_pm2_5_measurement_cluster(cluster_list, pm25_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+    esp_zb_cluster_list_add_temperature_meas_cluster(cluster_list, temperature_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+    esp_zb_cluster_list_add_humidity_meas_cluster(cluster_list, humidity_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+    esp_zb_cluster_list_add_custom_cluster(cluster_list, custom_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+    esp_zb_cluster_list_add_custom_cluster(cluster_list, diagnostics_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
 
     esp_zb_ep_list_add_ep(endpoint_list, cluster_list, DEFAULT_ENDPOINT, ESP_ZB_AF_HA_PROFILE_ID, ESP_ZB_HA_SIMPLE_SENSOR_DEVICE_ID);
     esp_zb_device_register(endpoint_list);
 
+    if (ota_offset)
+        esp_zb_zcl_set_attribute_val(DEFAULT_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE, ESP_ZB_ZCL_ATTR_OTA_UPGRADE_FILE_OFFSET_ID, &ota_offset, false);
+
+    set_reporting(ESP_ZB_ZCL_CLUSTER_ID_CARBON_DIOXIDE_MEASUREMENT, ESP_ZB_ZCL_ATTR_CARBON_DIOXIDE_MEASUREMENT_MEASURED_VALUE_ID, REPORT_MIN_INTERVAL, REPORT_MAX_INTERVAL, &co2_change, sizeof(co2_change));
+    set_reporting(ESP_ZB_ZCL_CLUSTER_ID_PM2_5_MEASUREMENT, ESP_ZB_ZCL_ATTR_PM2_5_MEASUREMENT_MEASURED_VALUE_ID, REPORT_MIN_INTERVAL, REPORT_MAX_INTERVAL, &pm25_change, sizeof(pm25_change));
+    set_reporting(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, REPORT_MIN_INTERVAL, REPORT_MAX_INTERVAL, &temperature_change, sizeof(temperature_change));
+    set_reporting(ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT, ESP_ZB_ZCL_ATTR_REL_HUMIDITY_MEASUREMENT_VALUE_ID, REPORT_MIN_INTERVAL, REPORT_MAX_INTERVAL, &humidity_change, sizeof(humidity_change));
+
     esp_zb_set_primary_network_channel_set(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
     esp_zb_core_action_handler_register(action_handler);
+    esp_zb_zcl_command_send_status_handler_register(send_status_handler);
 
     esp_zb_start(true);
+    esp_zb_scheduler_alarm(check_link, 0, LINK_CHECK_INTERVAL);
     esp_zb_main_loop_iteration();
 }
 
@@ -294,12 +732,26 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *data)
         case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
         case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
 
+            if (error == ESP_OK && !esp_zb_bdb_is_factory_new())
+            {
+                ESP_LOGI(tag, "Network state restored (channel: %d, PAN ID: 0x%04x)", esp_zb_get_current_channel(), esp_zb_get_pan_id());
+                set_joined();
+                break;
+            }
+
             if (error != ESP_OK)
             {
                 ESP_LOGE(tag, "Failed to initialize ZigBee stack (status: %d)", error);
                 reset_update_count(0);
             }
 
+            if (error != ESP_OK && !esp_zb_bdb_is_factory_new())
+            {
+                rejoin_failed(0);
+                break;
+            }
+
+            rejoin_count = 0;
             esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
             break;
 
@@ -318,8 +770,7 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *data)
                 esp_zb_get_extended_pan_id(pan_id);
                 ESP_LOGI(tag, "Successfully joined network (PAN ID: 0x%04x, Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x)", esp_zb_get_pan_id(), pan_id[7], pan_id[6], pan_id[5], pan_id[4], pan_id[3], pan_id[2], pan_id[1], pan_id[0]);
 
-                xTaskCreate(time_task, "time", 4096, NULL, 0, NULL);
-                steering_flag = 0;
+                set_joined();
             }
 
             break;
@@ -329,6 +780,11 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *data)
             if (((esp_zb_zdo_signal_leave_params_t*) esp_zb_app_signal_get_params(data->p_app_signal))->leave_type == ESP_ZB_NWK_LEAVE_TYPE_RESET)
                 reset_to_factory();
 
+            set_disconnected();
+            break;
+
+        case ESP_ZB_NWK_SIGNAL_NO_ACTIVE_LINKS_LEFT:
+            set_disconnected();
             break;
 
         default:
@@ -339,6 +795,9 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *data)
 
 void zigbee_init(void)
 {
+    ota_init();
+    scheduler_init_job(&arm_job, arm_updates, "zigbee updates");
+
     basic.zcl_version = ZCL_VERSION;
     basic.application_version = APPLICATION_VERSION;
     basic.power_source = POWER_SOURCE;
@@ -347,10 +806,81 @@ void zigbee_init(void)
     set_zcl_string(basic.model_identifier, MODEL_IDENTIFIER);
     set_zcl_string(basic.sw_build, SW_BUILD);
 
+    measurement_subscribe(measurement_callback);
     xTaskCreate(zigbee_task, "zigbee", 4096, NULL, 5, NULL);
 }
 
+void zigbee_update_diagnostics(void)
+{
+    queue_update(UPDATE_DIAGNOSTICS);
+}
+
+void zigbee_update_scd40_mode(void)
+{
+    queue_update(UPDATE_SCD40_MODE);
+}
+
+void zigbee_read_time(void)
+{
+    esp_zb_zcl_read_attr_cmd_t request;
+    uint16_t attribute_id = ESP_ZB_ZCL_ATTR_TIME_LOCAL_TIME_ID;
+
+    if (!connected)
+        return;
+
+    request.zcl_basic_cmd.dst_endpoint = 0x01;
+    request.zcl_basic_cmd.src_endpoint = DEFAULT_ENDPOINT;
+    request.zcl_basic_cmd.dst_addr_u.addr_short = 0x0000;
+    request.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    request.clusterID = ESP_ZB_ZCL_CLUSTER_ID_TIME;
+    request.attr_number = 1;
+    request.attr_field = &attribute_id;
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    esp_zb_zcl_read_attr_cmd_req(&request);
+    esp_zb_lock_release();
+}
+
+uint8_t zigbee_send_summary(uint8_t *payload)
+{
+    esp_zb_zcl_custom_cluster_cmd_req_t request;
+
+    if (!connected)
+        return 0;
+
+    memset(&request, 0, sizeof(request));
+
+    request.zcl_basic_cmd.dst_addr_u.addr_short = 0x0000;
+    request.zcl_basic_cmd.dst_endpoint = 0x01;
+    request.zcl_basic_cmd.src_endpoint = DEFAULT_ENDPOINT;
+    request.address_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    request.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    request.cluster_id = CUSTOM_CLUSTER;
+    request.custom_cmd_id = OFFLINE_SUMMARY;
+    request.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI;
+    request.data.type = ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING;
+    request.data.size = payload[0] + 1;
+    request.data.value = payload;
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    summary_tsn = esp_zb_zcl_custom_cluster_cmd_req(&request);
+    summary_pending = 1;
+    esp_zb_lock_release();
+
+    return 1;
+}
+
 uint8_t zigbee_steering(void)
 {
     return steering_flag;
 }
+
+uint8_t zigbee_connected(void)
+{
+    return connected;
+}
+
+void zigbee_log_updates(void)
+{
+    ESP_LOGI(tag, "Applied %ld attribute updates, %ld coalesced, depth max is %ld, latency max is %ld ms, lock held up to %ld us", update_stats.applied, update_stats.coalesced, update_stats.depth_max, update_stats.latency_max, update_stats.hold_max);
+}
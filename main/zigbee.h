@@ -4,6 +4,12 @@
 #include <stdint.h>
 
 void    zigbee_init(void);
+void    zigbee_update_diagnostics(void);
+void    zigbee_update_scd40_mode(void);
+void    zigbee_read_time(void);
+uint8_t zigbee_send_summary(uint8_t *payload);
 uint8_t zigbee_steering(void);
+uint8_t zigbee_connected(void);
+void    zigbee_log_updates(void);
 
 #endif
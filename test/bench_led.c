@@ -0,0 +1,36 @@
+#include "led.c"
+#include "benchmark.h"
+
+uint32_t bench_gauge(uint32_t iterations)
+{
+    uint32_t checksum = 0;
+    uint8_t color[3];
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        set_color(&co2_gauge, CO2_MIN_VALUE + i % (CO2_MAX_VALUE - CO2_MIN_VALUE + 200), i & 0xFF, color);
+        checksum += color[0] + color[1];
+    }
+
+    return checksum;
+}
+
+uint32_t bench_frame(uint32_t iterations)
+{
+    static uint8_t initialized = 0;
+
+    if (!initialized)
+    {
+        led_init();
+        initialized = 1;
+    }
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        co2_value = CO2_MIN_VALUE + i % (CO2_MAX_VALUE - CO2_MIN_VALUE);
+        render(i * LED_FRAME_INTERVAL, 255);
+        refresh();
+    }
+
+    return rendered;
+}
@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include "pm1006.c"
+#include "benchmark.h"
+
+uint32_t bench_capture(uint8_t *data, uint32_t length)
+{
+    uint32_t position = 0, inserted = 0;
+
+    srand(3);
+
+    while (position + PM1006_FRAME_LENGTH <= length)
+    {
+        uint8_t checksum = 0;
+
+        if (rand() % 8 == 0)
+        {
+            data[position++] = rand();
+            continue;
+        }
+
+        memcpy(data + position, header, sizeof(header));
+        memset(data + position + sizeof(header), 0, PM1006_FRAME_LENGTH - sizeof(header));
+        data[position + 6] = rand();
+
+        for (uint8_t i = 0; i < PM1006_FRAME_LENGTH - 1; i++)
+            checksum += data[position + i];
+
+        data[position + PM1006_FRAME_LENGTH - 1] = rand() % 50 ? -checksum : checksum;
+        position += rand() % 20 ? PM1006_FRAME_LENGTH : PM1006_FRAME_LENGTH / 2;
+        inserted++;
+    }
+
+    while (position < length)
+        data[position++] = 0;
+
+    return inserted;
+}
+
+uint32_t bench_parser(const uint8_t *data, uint32_t length)
+{
+    uint32_t frames = parser.frames;
+
+    parser.callback = frame_callback;
+
+    for (uint32_t i = 0; i < length; i++)
+        parse_byte(data[i]);
+
+    return parser.frames - frames;
+}
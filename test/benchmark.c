@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "benchmark.h"
+#include "crc.h"
+#include "crc_variants.h"
+#include "history.h"
+#include "journal.h"
+#include "measurement.h"
+#include "stubs.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+static uint32_t allocations = 0, published = 0;
+static volatile uint32_t sink;
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    allocations++;
+    return __real_realloc(pointer, size);
+}
+
+static uint64_t now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void report(const char *name, uint64_t start, uint32_t count, uint32_t allocated)
+{
+    printf("%-24s %10.1f ns/call %10lu calls %6lu allocations\n", name, (double) (now() - start) / count, (unsigned long) count, (unsigned long) allocated);
+}
+
+static void subscriber(uint8_t type)
+{
+    published += type + 1;
+}
+
+static void bench_crc_variant(const char *name, uint8_t (*function)(const void *data, size_t length), uint32_t iterations)
+{
+    uint8_t response[9] = {0x01, 0xF4, 0x33, 0x66, 0x67, 0xA2, 0x5E, 0xB9, 0x3C};
+    uint32_t checksum = 0, start_allocations = allocations;
+    uint64_t start = now();
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        response[0] = i;
+        checksum += function(response, 2) + function(response + 3, 2) + function(response + 6, 2);
+    }
+
+    report(name, start, iterations, allocations - start_allocations);
+    sink = checksum;
+}
+
+static void bench_crc(uint32_t iterations)
+{
+    bench_crc_variant("crc8 bitwise response", crc8_bitwise, iterations);
+    bench_crc_variant("crc8 table response", crc8_table, iterations);
+    bench_crc_variant("crc8 nibble response", crc8_nibble, iterations);
+    bench_crc_variant("crc8 response", crc8, iterations);
+}
+
+static void bench_led(uint32_t iterations)
+{
+    uint32_t start_allocations = allocations;
+    uint64_t start = now();
+
+    sink = bench_gauge(iterations);
+    report("gauge color", start, iterations, allocations - start_allocations);
+
+    start = now();
+    sink = bench_frame(iterations / 100 + 1);
+    report("led frame", start, iterations / 100 + 1, allocations - start_allocations);
+}
+
+static void bench_pm1006(uint32_t iterations)
+{
+    uint32_t length = iterations < 4096 ? 4096 : iterations, inserted, frames, start_allocations;
+    uint8_t *capture = malloc(length);
+    uint64_t start, time;
+
+    inserted = bench_capture(capture, length);
+    start_allocations = allocations;
+    start = now();
+    frames = bench_parser(capture, length);
+    time = now() - start;
+
+    report("pm1006 parser byte", start, length, allocations - start_allocations);
+    printf("%-24s %10.0f frames/s, %lu of %lu frames accepted\n", "pm1006 parser frames", time ? frames * 1e9 / time : 0, (unsigned long) frames, (unsigned long) inserted);
+    free(capture);
+}
+
+static void bench_publish(uint32_t iterations)
+{
+    uint32_t start_allocations = allocations;
+    uint64_t start;
+
+    measurement_subscribe(subscriber);
+    measurement_subscribe(subscriber);
+    start = now();
+
+    for (uint32_t i = 0; i < iterations; i++)
+        measurement_publish(i % MEASUREMENT_COUNT, i);
+
+    report("measurement publish", start, iterations, allocations - start_allocations);
+    sink = published;
+}
+
+static void bench_journal(uint32_t iterations)
+{
+    uint8_t record[HISTORY_RECORD_SIZE] = {0x19, 0x00, 0x0C};
+    uint32_t records = iterations / 100 + 1, start_allocations = allocations;
+    uint64_t start, payload = (uint64_t) records * (sizeof(uint32_t) + HISTORY_RECORD_SIZE);
+
+    stub_flash_erase();
+    stub_synced = 1;
+    stub_boot_wall = 1700000000;
+    journal_init();
+    start = now();
+
+    for (uint32_t i = 0; i < records; i++)
+        journal_append(stub_boot_wall + i * 60, record);
+
+    journal_flush();
+    report("journal append", start, records, allocations - start_allocations);
+    printf("%-24s %10.2f bytes written per payload byte, %lu sector erases, %.1f records per erase\n", "journal wear", (double) stub_flash.bytes_written / payload, (unsigned long) stub_flash.erases, (double) records / stub_flash.erases);
+
+    stub_flash.reads = 0;
+    stub_flash.bytes_read = 0;
+    start = now();
+    journal_init();
+    report("journal recovery", start, 1, allocations - start_allocations);
+    printf("%-24s %10lu reads, %lu bytes read\n", "journal recovery io", (unsigned long) stub_flash.reads, (unsigned long) stub_flash.bytes_read);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+
+    if (!iterations)
+        iterations = 1;
+
+    bench_crc(iterations);
+    bench_led(iterations);
+    bench_pm1006(iterations);
+    bench_publish(iterations);
+    bench_journal(iterations);
+    return 0;
+}
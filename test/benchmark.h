@@ -0,0 +1,11 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdint.h>
+
+uint32_t bench_gauge(uint32_t iterations);
+uint32_t bench_frame(uint32_t iterations);
+uint32_t bench_capture(uint8_t *data, uint32_t length);
+uint32_t bench_parser(const uint8_t *data, uint32_t length);
+
+#endif
@@ -0,0 +1,17 @@
+#include "crc_variants.h"
+
+uint8_t crc8_bitwise(const void *data, size_t length)
+{
+    const uint8_t *buffer = data;
+    uint8_t crc = 0xFF;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= buffer[i];
+
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+
+    return crc;
+}
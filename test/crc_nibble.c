@@ -0,0 +1,7 @@
+#include "config.h"
+
+#undef CRC_NIBBLE_TABLE
+#define CRC_NIBBLE_TABLE        1
+#define crc8                    crc8_nibble
+
+#include "crc.c"
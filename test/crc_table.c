@@ -0,0 +1,7 @@
+#include "config.h"
+
+#undef CRC_NIBBLE_TABLE
+#define CRC_NIBBLE_TABLE        0
+#define crc8                    crc8_table
+
+#include "crc.c"
@@ -0,0 +1,11 @@
+#ifndef CRC_VARIANTS_H
+#define CRC_VARIANTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint8_t crc8_bitwise(const void *data, size_t length);
+uint8_t crc8_table(const void *data, size_t length);
+uint8_t crc8_nibble(const void *data, size_t length);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef UART_H
+#define UART_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/queue.h"
+
+typedef enum
+{
+    UART_NUM_0,
+    UART_NUM_1
+} uart_port_t;
+
+typedef enum
+{
+    UART_DATA,
+    UART_BUFFER_FULL,
+    UART_FIFO_OVF
+} uart_event_type_t;
+
+typedef enum
+{
+    UART_DATA_8_BITS = 0x03
+} uart_word_length_t;
+
+typedef enum
+{
+    UART_STOP_BITS_1 = 0x01
+} uart_stop_bits_t;
+
+typedef struct
+{
+    uart_event_type_t type;
+    size_t            size;
+} uart_event_t;
+
+typedef struct
+{
+    int                baud_rate;
+    uart_word_length_t data_bits;
+    uart_stop_bits_t   stop_bits;
+} uart_config_t;
+
+#define UART_PIN_NO_CHANGE      (-1)
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_size, int tx_size, int queue_size, QueueHandle_t *queue, int flags);
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config);
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts);
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size);
+esp_err_t uart_flush_input(uart_port_t port);
+int       uart_read_bytes(uart_port_t port, void *buffer, uint32_t length, TickType_t wait);
+int       uart_write_bytes(uart_port_t port, const void *data, size_t length);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include "esp_err.h"
+
+void stub_log(char level, const char *tag, const char *format, ...);
+
+#define ESP_LOGE(tag, ...)      stub_log('E', tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...)      stub_log('W', tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...)      stub_log('I', tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...)      stub_log('D', tag, __VA_ARGS__)
+
+#endif
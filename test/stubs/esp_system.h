@@ -0,0 +1,13 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
+uint32_t  esp_get_free_heap_size(void);
+uint32_t  esp_get_minimum_free_heap_size(void);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int32_t  BaseType_t;
+typedef int      portMUX_TYPE;
+typedef void    *TaskHandle_t;
+typedef struct stub_queue *QueueHandle_t;
+
+#define pdTRUE                          1
+#define pdFALSE                         0
+#define portMAX_DELAY                   0xFFFFFFFF
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define pdMS_TO_TICKS(ms)               ((TickType_t) (ms))
+
+#define taskENTER_CRITICAL(lock)        ((void) (lock))
+#define taskEXIT_CRITICAL(lock)         ((void) (lock))
+
+#endif
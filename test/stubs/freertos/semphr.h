@@ -0,0 +1,12 @@
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct stub_semaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#endif
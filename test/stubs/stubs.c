@@ -0,0 +1,410 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "led_strip.h"
+#include "reset.h"
+#include "scheduler.h"
+#include "settings.h"
+#include "stubs.h"
+#include "timesync.h"
+#include "zigbee.h"
+
+#define MAX_JOBS                32
+
+struct stub_queue
+{
+    uint8_t overflow;
+};
+
+struct stub_semaphore
+{
+    uint8_t taken;
+};
+
+int64_t  stub_time = 0;
+uint32_t stub_boot_wall = 0;
+uint8_t  stub_synced = 0;
+uint8_t  stub_settings[SETTINGS_COUNT] = {1, 255, 0, 0, 0};
+uint8_t  stub_leds[STUB_LED_COUNT][3];
+uint32_t stub_led_refreshes = 0;
+struct stub_flash stub_flash;
+
+static struct scheduler_job *jobs[MAX_JOBS];
+static uint8_t job_count = 0, flash[STUB_FLASH_SIZE], uart_buffer[STUB_UART_SIZE];
+static size_t uart_length = 0;
+static struct stub_queue uart_queue;
+static struct stub_semaphore semaphores[8];
+static uint8_t semaphore_count = 0, flash_erased = 0;
+static const esp_partition_t history_partition = {ESP_PARTITION_TYPE_DATA, 0x40, 0, STUB_FLASH_SIZE, "history"};
+
+void stub_log(char level, const char *tag, const char *format, ...)
+{
+    va_list args;
+
+    if (!getenv("STUB_LOG"))
+        return;
+
+    va_start(args, format);
+    printf("%c (%lld) %s: ", level, (long long) (stub_time / 1000), tag);
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+void stub_advance(uint32_t ms)
+{
+    stub_time += (int64_t) ms * 1000;
+}
+
+struct scheduler_job *stub_job(const char *name)
+{
+    for (uint8_t i = 0; i < job_count; i++)
+        if (!strcmp(jobs[i]->name, name))
+            return jobs[i];
+
+    return NULL;
+}
+
+uint8_t stub_run(struct scheduler_job *job)
+{
+    if (!job || (!job->armed && !atomic_load(&job->queued)))
+        return 0;
+
+    job->armed = 0;
+    atomic_store(&job->queued, false);
+    job->callback();
+    return 1;
+}
+
+void stub_flash_erase(void)
+{
+    memset(flash, 0xFF, sizeof(flash));
+    memset(&stub_flash, 0, sizeof(stub_flash));
+    flash_erased = 1;
+}
+
+void stub_uart_feed(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (uart_length >= sizeof(uart_buffer))
+        {
+            uart_queue.overflow = 1;
+            return;
+        }
+
+        uart_buffer[uart_length++] = data[i];
+    }
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    return code == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return stub_time;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    (void) handler;
+    return ESP_OK;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 0;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    (void) subtype;
+
+    if (type != ESP_PARTITION_TYPE_DATA || !label || strcmp(label, history_partition.label))
+        return NULL;
+
+    if (!flash_erased)
+        stub_flash_erase();
+
+    return &history_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *data, size_t size)
+{
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    memcpy(data, flash + offset, size);
+    stub_flash.reads++;
+    stub_flash.bytes_read += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *data, size_t size)
+{
+    const uint8_t *source = data;
+
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    for (size_t i = 0; i < size; i++)
+        flash[offset + i] &= source[i];
+
+    stub_flash.writes++;
+    stub_flash.bytes_written += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % 4096 || size % 4096 || offset + size > partition->size)
+        return ESP_ERR_INVALID_ARG;
+
+    memset(flash + offset, 0xFF, size);
+    stub_flash.erases += size / 4096;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config, led_strip_handle_t *handle)
+{
+    (void) led_config;
+    (void) rmt_config;
+    *handle = (led_strip_handle_t) stub_leds;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_set_pixel(led_strip_handle_t handle, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+    (void) handle;
+
+    if (index >= STUB_LED_COUNT)
+        return ESP_ERR_INVALID_ARG;
+
+    stub_leds[index][0] = red;
+    stub_leds[index][1] = green;
+    stub_leds[index][2] = blue;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_refresh(led_strip_handle_t handle)
+{
+    (void) handle;
+    stub_led_refreshes++;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_clear(led_strip_handle_t handle)
+{
+    (void) handle;
+    memset(stub_leds, 0, sizeof(stub_leds));
+    stub_led_refreshes++;
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_size, int tx_size, int queue_size, QueueHandle_t *queue, int flags)
+{
+    (void) port;
+    (void) rx_size;
+    (void) tx_size;
+    (void) queue_size;
+    (void) flags;
+
+    if (queue)
+        *queue = &uart_queue;
+
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config)
+{
+    (void) port;
+    (void) config;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts)
+{
+    (void) port;
+    (void) tx;
+    (void) rx;
+    (void) rts;
+    (void) cts;
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size)
+{
+    (void) port;
+    *size = uart_length;
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t port)
+{
+    (void) port;
+    uart_length = 0;
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t port, void *buffer, uint32_t length, TickType_t wait)
+{
+    (void) port;
+    (void) wait;
+
+    if (length > uart_length)
+        length = uart_length;
+
+    memcpy(buffer, uart_buffer, length);
+    memmove(uart_buffer, uart_buffer + length, uart_length - length);
+    uart_length -= length;
+    return length;
+}
+
+int uart_write_bytes(uart_port_t port, const void *data, size_t length)
+{
+    (void) port;
+    (void) data;
+    return length;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    uart_event_t *event = item;
+
+    (void) wait;
+
+    if (queue != &uart_queue || !uart_queue.overflow)
+        return pdFALSE;
+
+    memset(event, 0, sizeof(*event));
+    event->type = UART_FIFO_OVF;
+    uart_queue.overflow = 0;
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    queue->overflow = 0;
+    return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return semaphore_count < sizeof(semaphores) / sizeof(semaphores[0]) ? &semaphores[semaphore_count++] : NULL;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    (void) wait;
+
+    if (semaphore->taken)
+    {
+        fprintf(stderr, "Mutex taken twice\n");
+        abort();
+    }
+
+    semaphore->taken = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    semaphore->taken = 0;
+    return pdTRUE;
+}
+
+void scheduler_init_job(struct scheduler_job *job, void (*callback)(void), const char *name)
+{
+    memset(job, 0, sizeof(*job));
+    job->callback = callback;
+    job->name = name;
+
+    if (!stub_job(name) && job_count < MAX_JOBS)
+        jobs[job_count++] = job;
+}
+
+void scheduler_delay(struct scheduler_job *job, uint32_t delay)
+{
+    job->deadline = esp_timer_get_time() / 1000 + delay;
+    job->armed = 1;
+}
+
+void scheduler_repeat(struct scheduler_job *job, uint32_t interval)
+{
+    scheduler_delay(job, interval);
+}
+
+void scheduler_cancel(struct scheduler_job *job)
+{
+    job->armed = 0;
+}
+
+void scheduler_post(struct scheduler_job *job)
+{
+    atomic_store(&job->queued, true);
+}
+
+void scheduler_post_from_isr(struct scheduler_job *job)
+{
+    scheduler_post(job);
+}
+
+uint32_t scheduler_wakeups(void)
+{
+    return 0;
+}
+
+uint8_t timesync_valid(void)
+{
+    return stub_synced;
+}
+
+uint32_t timesync_monotonic(void)
+{
+    return stub_time / 1000;
+}
+
+uint32_t timesync_wall(uint32_t monotonic)
+{
+    int64_t now = stub_time / 1000, time = now + (int32_t) (monotonic - (uint32_t) now);
+
+    if (!stub_synced)
+        return 0;
+
+    return stub_boot_wall + (time >= 0 ? time / 1000 : (time - 999) / 1000);
+}
+
+uint8_t settings_get(uint8_t id)
+{
+    return id < SETTINGS_COUNT ? stub_settings[id] : 0;
+}
+
+void settings_set(uint8_t id, uint8_t value)
+{
+    if (id < SETTINGS_COUNT)
+        stub_settings[id] = value;
+}
+
+uint8_t reset_pending(void)
+{
+    return 0;
+}
+
+uint8_t zigbee_steering(void)
+{
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef STUBS_H
+#define STUBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scheduler.h"
+
+#define STUB_LED_COUNT          16
+#define STUB_FLASH_SIZE         (28 * 1024)
+#define STUB_UART_SIZE          512
+
+struct stub_flash
+{
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+};
+
+extern int64_t  stub_time;
+extern uint32_t stub_boot_wall;
+extern uint8_t  stub_synced;
+extern uint8_t  stub_settings[];
+extern uint8_t  stub_leds[STUB_LED_COUNT][3];
+extern uint32_t stub_led_refreshes;
+extern struct stub_flash stub_flash;
+
+void     stub_advance(uint32_t ms);
+struct scheduler_job *stub_job(const char *name);
+uint8_t  stub_run(struct scheduler_job *job);
+void     stub_flash_erase(void);
+void     stub_uart_feed(const uint8_t *data, size_t length);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+#define CHECK(condition)        do { if (!(condition)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+#define RESULT()                (printf("%s\n", failures ? "FAILED" : "OK"), failures ? 1 : 0)
+
+static int failures = 0;
+
+#endif
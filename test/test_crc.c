@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include "crc.h"
+#include "crc_variants.h"
+#include "test.h"
+
+int main(void)
+{
+    uint8_t word[2] = {0xBE, 0xEF}, buffer[64];
+
+    CHECK(crc8(word, sizeof(word)) == 0x92);
+    CHECK(crc8(word, 0) == 0xFF);
+
+    for (uint32_t i = 0; i < 0x10000; i++)
+    {
+        uint8_t expected;
+
+        word[0] = i >> 8;
+        word[1] = i;
+        expected = crc8_bitwise(word, sizeof(word));
+
+        CHECK(crc8_table(word, sizeof(word)) == expected);
+        CHECK(crc8_nibble(word, sizeof(word)) == expected);
+        CHECK(crc8(word, sizeof(word)) == expected);
+    }
+
+    srand(1);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        size_t length = rand() % sizeof(buffer);
+
+        for (size_t j = 0; j < length; j++)
+            buffer[j] = rand();
+
+        CHECK(crc8_table(buffer, length) == crc8_bitwise(buffer, length));
+        CHECK(crc8_nibble(buffer, length) == crc8_bitwise(buffer, length));
+    }
+
+    return RESULT();
+}
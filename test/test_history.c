@@ -0,0 +1,78 @@
+#include "config.h"
+#include "history.h"
+#include "journal.h"
+#include "measurement.h"
+#include "stubs.h"
+#include "test.h"
+
+#define BOOT_WALL               1700000000
+
+static void sample(struct scheduler_job *job, uint32_t minutes)
+{
+    for (uint32_t i = 0; i < minutes * 12; i++)
+    {
+        stub_advance(5000);
+        stub_run(job);
+    }
+}
+
+static uint16_t co2(const uint8_t *record)
+{
+    return record[0] << 5 | record[1] >> 3;
+}
+
+static uint16_t pm25(const uint8_t *record)
+{
+    return (record[1] & 0x07) << 8 | record[2];
+}
+
+int main(void)
+{
+    struct scheduler_job *job;
+    uint8_t buffer[64 * HISTORY_RECORD_SIZE], count;
+    uint32_t timestamp, written;
+
+    history_init();
+    journal_init();
+    job = stub_job("history");
+
+    measurement_publish(MEASUREMENT_CO2, 800);
+    measurement_publish(MEASUREMENT_PM25, 12);
+
+    sample(job, 10);
+
+    CHECK(history_read(HISTORY_MINUTE, 0, 64, &timestamp, buffer) == 0);
+
+    stub_boot_wall = BOOT_WALL;
+    stub_synced = 1;
+
+    count = history_read(HISTORY_MINUTE, 0, 64, &timestamp, buffer);
+    CHECK(count == 10);
+    CHECK(timestamp == BOOT_WALL + 60);
+    CHECK(co2(buffer) == 800 && pm25(buffer) == 12);
+
+    count = history_read(HISTORY_RAW, 0, 64, &timestamp, buffer);
+    CHECK(count == 64);
+    CHECK(timestamp == BOOT_WALL + 5);
+
+    count = history_read(HISTORY_MINUTE, BOOT_WALL + 300, 64, &timestamp, buffer);
+    CHECK(count == 6);
+    CHECK(timestamp == BOOT_WALL + 300);
+
+    written = stub_flash.bytes_written;
+    sample(job, JOURNAL_BATCH);
+    CHECK(stub_flash.bytes_written > written);
+
+    measurement_publish(MEASUREMENT_CO2, 0);
+    measurement_publish(MEASUREMENT_PM25, 0);
+    sample(job, 3);
+    measurement_publish(MEASUREMENT_CO2, 900);
+    sample(job, 1);
+
+    count = history_read(HISTORY_MINUTE, 0, 64, &timestamp, buffer);
+    CHECK(count == 10 + JOURNAL_BATCH + 4);
+    CHECK(co2(buffer + (count - 4) * HISTORY_RECORD_SIZE) == 0);
+    CHECK(co2(buffer + (count - 1) * HISTORY_RECORD_SIZE) == 900);
+
+    return RESULT();
+}
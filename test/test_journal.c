@@ -0,0 +1,58 @@
+#include "history.h"
+#include "journal.h"
+#include "measurement.h"
+#include "stubs.h"
+#include "test.h"
+
+#define START_WALL              1700000000
+#define RECORDS                 30
+#define DOWNTIME                3600
+
+int main(void)
+{
+    struct scheduler_job *job;
+    uint8_t record[HISTORY_RECORD_SIZE] = {600 >> 5, (600 & 0x1F) << 3, 7}, buffer[128 * HISTORY_RECORD_SIZE], count;
+    uint32_t timestamp, erases;
+
+    journal_init();
+    CHECK(stub_flash.erases == 1);
+
+    stub_synced = 1;
+    stub_boot_wall = START_WALL;
+
+    for (uint32_t i = 0; i < RECORDS; i++)
+        journal_append(START_WALL + i * 60, record);
+
+    journal_flush();
+    erases = stub_flash.erases;
+
+    stub_time = 1000000;
+    stub_synced = 0;
+    stub_boot_wall = START_WALL + (RECORDS - 1) * 60 + DOWNTIME;
+
+    history_init();
+    journal_init();
+    job = stub_job("history");
+    CHECK(stub_flash.erases == erases);
+
+    measurement_publish(MEASUREMENT_CO2, 900);
+
+    for (uint32_t i = 0; i < 24; i++)
+    {
+        stub_advance(5000);
+        stub_run(job);
+    }
+
+    stub_synced = 1;
+    stub_advance(5000);
+    stub_run(job);
+
+    count = history_read(HISTORY_MINUTE, 0, 128, &timestamp, buffer);
+    CHECK(count == RECORDS + DOWNTIME / 60 + 2);
+    CHECK(timestamp + 60 > START_WALL && timestamp < START_WALL + 60);
+    CHECK(buffer[0] == record[0] && buffer[1] == record[1] && buffer[2] == record[2]);
+    CHECK(!buffer[RECORDS * HISTORY_RECORD_SIZE] && !buffer[(count - 3) * HISTORY_RECORD_SIZE]);
+    CHECK(buffer[(count - 1) * HISTORY_RECORD_SIZE] == 900 >> 5);
+
+    return RESULT();
+}
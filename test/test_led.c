@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include "led.c"
+#include "stubs.h"
+#include "test.h"
+
+static void check_gauge(const struct gauge *gauge)
+{
+    uint8_t color[3], red = 0, green = 255;
+
+    set_color(gauge, gauge->min, 255, color);
+    CHECK(color[0] == 0 && color[1] == 255);
+
+    set_color(gauge, gauge->max, 255, color);
+    CHECK(color[0] == 255 && color[1] == 0);
+
+    for (uint32_t value = gauge->min; value <= gauge->max; value++)
+    {
+        int expected_red = value < gauge->mid ? 255 * (value - gauge->min) / (gauge->mid - gauge->min) : 255, expected_green = value < gauge->mid ? 255 : 255 * (gauge->max - value) / (gauge->max - gauge->mid);
+
+        set_color(gauge, value, 255, color);
+
+        CHECK(abs(color[0] - expected_red) <= 1);
+        CHECK(abs(color[1] - expected_green) <= 1);
+        CHECK(color[0] >= red && color[1] <= green);
+
+        red = color[0];
+        green = color[1];
+    }
+}
+
+static uint32_t settle(struct scheduler_job *job)
+{
+    uint32_t frames = 0;
+
+    while (frames < 1000 && stub_run(job))
+    {
+        stub_advance(LED_FRAME_INTERVAL);
+        frames++;
+    }
+
+    return frames;
+}
+
+int main(void)
+{
+    struct scheduler_job *job;
+    uint32_t refreshes, count;
+
+    check_gauge(&co2_gauge);
+    check_gauge(&pm25_gauge);
+
+    led_init();
+    job = stub_job("led");
+
+    measurement_publish(MEASUREMENT_CO2, CO2_MIN_VALUE);
+    measurement_publish(MEASUREMENT_PM25, PM25_MAX_VALUE);
+
+    count = settle(job);
+    CHECK(count > LED_FADE_TIME / LED_FRAME_INTERVAL && count < 1000);
+    CHECK(!stub_leds[GROUP_CO2 * GROUP_SIZE][0] && stub_leds[GROUP_CO2 * GROUP_SIZE][1] && !stub_leds[GROUP_CO2 * GROUP_SIZE][2]);
+    CHECK(stub_leds[GROUP_PM25 * GROUP_SIZE][0] && !stub_leds[GROUP_PM25 * GROUP_SIZE][1] && !stub_leds[GROUP_PM25 * GROUP_SIZE][2]);
+
+    refreshes = stub_led_refreshes;
+    count = led_frames_skipped();
+
+    led_update();
+    CHECK(settle(job) == 1);
+    CHECK(stub_led_refreshes == refreshes);
+    CHECK(led_frames_skipped() == count + 1);
+
+    measurement_publish(MEASUREMENT_CO2, CO2_MAX_VALUE);
+    CHECK(settle(job) == 1);
+    CHECK(stub_led_refreshes == refreshes + 1);
+    CHECK(stub_leds[GROUP_CO2 * GROUP_SIZE][0] && !stub_leds[GROUP_CO2 * GROUP_SIZE][1]);
+
+    return RESULT();
+}
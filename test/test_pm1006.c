@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pm1006.c"
+#include "stubs.h"
+#include "test.h"
+
+static uint16_t values[64];
+static uint8_t received = 0;
+
+static void capture(const uint8_t *frame)
+{
+    if (received < sizeof(values) / sizeof(values[0]))
+        values[received++] = frame[5] << 8 | frame[6];
+}
+
+static void build_frame(uint8_t *frame, uint16_t value)
+{
+    uint8_t checksum = 0;
+
+    memset(frame, 0, PM1006_FRAME_LENGTH);
+    memcpy(frame, header, sizeof(header));
+
+    frame[5] = value >> 8;
+    frame[6] = value;
+
+    for (uint8_t i = 0; i < PM1006_FRAME_LENGTH - 1; i++)
+        checksum += frame[i];
+
+    frame[PM1006_FRAME_LENGTH - 1] = -checksum;
+}
+
+static void feed(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        parse_byte(data[i]);
+}
+
+static void reset(void)
+{
+    memset(&parser, 0, sizeof(parser));
+    parser.callback = capture;
+    received = 0;
+}
+
+static void test_parser(void)
+{
+    uint8_t frame[PM1006_FRAME_LENGTH], other[PM1006_FRAME_LENGTH], noise[3] = {0x00, 0x16, 0xFF};
+
+    reset();
+    build_frame(frame, 35);
+    feed(frame, sizeof(frame));
+    CHECK(received == 1 && values[0] == 35);
+
+    reset();
+    feed(noise, sizeof(noise));
+    feed(frame, 7);
+    feed(frame + 7, sizeof(frame) - 7);
+    CHECK(received == 1 && values[0] == 35 && !parser.errors);
+
+    reset();
+    build_frame(other, 120);
+    feed(frame, 7);
+    feed(other, sizeof(other));
+    CHECK(received == 1 && values[0] == 120 && parser.errors == 1);
+
+    reset();
+    frame[10] ^= 0x01;
+    feed(frame, sizeof(frame));
+    CHECK(!received && parser.errors == 1 && parser.frames == 0);
+}
+
+static void test_stream(void)
+{
+    uint8_t frame[PM1006_FRAME_LENGTH];
+    uint32_t inserted = 0;
+
+    reset();
+    srand(2);
+
+    for (uint32_t i = 0; i < 5000; i++)
+    {
+        uint8_t byte = rand();
+
+        if (rand() % 40)
+        {
+            parse_byte(byte == header[0] ? byte + 1 : byte);
+            continue;
+        }
+
+        build_frame(frame, inserted % 1000);
+        feed(frame, sizeof(frame));
+        CHECK(received == inserted % 64 + 1 && values[inserted % 64] == inserted % 1000);
+
+        if (++inserted % 64 == 0)
+            received = 0;
+    }
+
+    CHECK(inserted > 0 && parser.frames == inserted);
+
+    reset();
+
+    for (uint32_t i = 0; i < 100000; i++)
+    {
+        parse_byte(rand());
+        CHECK(parser.length < PM1006_FRAME_LENGTH);
+    }
+
+    CHECK(parser.frames == received || received == sizeof(values) / sizeof(values[0]));
+}
+
+static void test_driver(void)
+{
+    uint8_t frame[PM1006_FRAME_LENGTH], noise[600];
+
+    pm1006_init();
+    build_frame(frame, 42);
+
+    CHECK(stub_run(stub_job("pm1006")));
+    stub_uart_feed(frame, sizeof(frame));
+    CHECK(stub_run(stub_job("pm1006 read")));
+    CHECK(measurement_value(MEASUREMENT_PM25) == 42);
+
+    memset(noise, 0, sizeof(noise));
+    CHECK(stub_run(stub_job("pm1006")));
+    stub_uart_feed(noise, sizeof(noise));
+    CHECK(stub_run(stub_job("pm1006 read")));
+    CHECK(!count);
+
+    CHECK(stub_run(stub_job("pm1006")));
+    stub_uart_feed(frame, sizeof(frame));
+    CHECK(stub_run(stub_job("pm1006 read")));
+    CHECK(measurement_value(MEASUREMENT_PM25) == 42);
+}
+
+int main(void)
+{
+    test_parser();
+    test_stream();
+    test_driver();
+    return RESULT();
+}
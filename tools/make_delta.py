@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = b"VZD1"
+MAX_COPY = 1024
+MAX_DATA_SIZE = 64
+OTA_HEADER_SIZE = 56 + 6
+BLOCK_REQUEST_SIZE = 3 + 19
+BLOCK_RESPONSE_SIZE = 3 + 14
+BLOCK_SIZE = 16
+HASH_SIZE = 32
+MIN_MATCH = 32
+COPY = 0x00
+LITERAL = 0x01
+
+
+def build_index(source):
+    index = {}
+
+    for position in range(0, len(source) - BLOCK_SIZE + 1, 4):
+        index.setdefault(source[position:position + BLOCK_SIZE], position)
+
+    return index
+
+
+def match_length(source, target, source_position, target_position):
+    length = 0
+
+    while source_position + length < len(source) and target_position + length < len(target) and source[source_position + length] == target[target_position + length]:
+        length += 1
+
+    return length
+
+
+def make_patch(source, target):
+    index = build_index(source)
+    patch = bytearray(MAGIC)
+    literal = bytearray()
+    position = 0
+
+    patch += struct.pack("<II", len(target), len(source))
+    patch += source[-HASH_SIZE:]
+
+    def flush_literal():
+        if literal:
+            patch.extend(struct.pack("<BI", LITERAL, len(literal)) + literal)
+            literal.clear()
+
+    while position < len(target):
+        source_position = index.get(target[position:position + BLOCK_SIZE])
+        length = match_length(source, target, source_position, position) if source_position is not None else 0
+
+        if length < MIN_MATCH:
+            literal.append(target[position])
+            position += 1
+            continue
+
+        flush_literal()
+
+        while length:
+            chunk = min(length, MAX_COPY)
+            patch += struct.pack("<BII", COPY, source_position, chunk)
+            source_position += chunk
+            position += chunk
+            length -= chunk
+
+    flush_literal()
+    return bytes(patch)
+
+
+def apply_patch(source, patch):
+    size, source_size = struct.unpack_from("<II", patch, 4)
+    output = bytearray()
+    position = 44
+
+    if patch[:4] != MAGIC or source_size != len(source) or source[-HASH_SIZE:] != patch[12:44]:
+        raise ValueError("patch does not match the source image")
+
+    while position < len(patch):
+        opcode = patch[position]
+
+        if opcode == COPY:
+            offset, length = struct.unpack_from("<II", patch, position + 1)
+            output += source[offset:offset + length]
+            position += 9
+        elif opcode == LITERAL:
+            length, = struct.unpack_from("<I", patch, position + 1)
+            output += patch[position + 5:position + 5 + length]
+            position += 5 + length
+        else:
+            raise ValueError("invalid opcode 0x%02x at %d" % (opcode, position))
+
+    if len(output) != size:
+        raise ValueError("output size %d does not match %d" % (len(output), size))
+
+    return bytes(output)
+
+
+def check_digest(name, image):
+    if len(image) <= HASH_SIZE or hashlib.sha256(image[:-HASH_SIZE]).digest() != image[-HASH_SIZE:]:
+        sys.exit("%s has no appended SHA-256" % name)
+
+
+def wire_size(size):
+    blocks = (size + MAX_DATA_SIZE - 1) // MAX_DATA_SIZE
+    return blocks, OTA_HEADER_SIZE + size + blocks * (BLOCK_REQUEST_SIZE + BLOCK_RESPONSE_SIZE)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a delta OTA image against the factory firmware")
+    parser.add_argument("source", help="firmware image flashed to the factory partition")
+    parser.add_argument("target", help="new firmware image")
+    parser.add_argument("output", help="patch file to wrap into the Zigbee OTA file")
+    parser.add_argument("--max-ratio", type=float, help="fail if the delta needs more than this share of the full image bytes on the wire")
+    args = parser.parse_args()
+
+    with open(args.source, "rb") as file:
+        source = file.read()
+
+    with open(args.target, "rb") as file:
+        target = file.read()
+
+    check_digest(args.source, source)
+    check_digest(args.target, target)
+
+    patch = make_patch(source, target)
+
+    if apply_patch(source, patch) != target:
+        sys.exit("Patch verification failed")
+
+    with open(args.output, "wb") as file:
+        file.write(patch)
+
+    full_blocks, full_wire = wire_size(len(target))
+    delta_blocks, delta_wire = wire_size(len(patch))
+    ratio = delta_wire / full_wire
+
+    print("Full image:  %8d bytes, %5d blocks, %8d bytes on the wire" % (len(target), full_blocks, full_wire))
+    print("Delta image: %8d bytes, %5d blocks, %8d bytes on the wire (%.1f%%)" % (len(patch), delta_blocks, delta_wire, 100.0 * ratio))
+
+    if args.max_ratio is not None and ratio > args.max_ratio:
+        sys.exit("Delta image exceeds %.1f%% of the full image on the wire" % (100.0 * args.max_ratio))
+
+
+if __name__ == "__main__":
+    main()